@@ -0,0 +1,150 @@
+#include "bench_autogen.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum {
+  LINES_MAX = 4096,
+  LINE_LENGTH_MAX = 256,
+  ARGS_MAX = 32,
+  ROUNDS_DEFAULT = 100,
+};
+
+// A line of the input, already split into its arguments (as a shell would
+// have done), so that only Bench_processCommand() is timed
+typedef struct {
+  uint8_t argc;
+  char *argv[ARGS_MAX];
+} Line;
+
+static char text[LINES_MAX][LINE_LENGTH_MAX];
+static Line lines[LINES_MAX];
+
+static uint64_t now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int compareSamples(void const *a, void const *b) {
+  uint64_t x = *(uint64_t const *)a;
+  uint64_t y = *(uint64_t const *)b;
+  return (x > y) - (x < y);
+}
+
+static unsigned readLines(char const *path) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    perror(path);
+    exit(1);
+  }
+
+  unsigned count = 0;
+  while ((count < LINES_MAX) && fgets(text[count], LINE_LENGTH_MAX, f)) {
+    Line *line = &lines[count];
+    line->argc = 0;
+    for (char *arg = strtok(text[count], " \n"); arg != NULL;
+         arg = strtok(NULL, " \n")) {
+      if (line->argc < ARGS_MAX) {
+        line->argv[line->argc++] = arg;
+      }
+    }
+    if (line->argc > 0) {
+      count++;
+    }
+  }
+  fclose(f);
+  return count;
+}
+
+/**
+ * The time it takes to read the clock, which is taken off each sample.
+ */
+static uint64_t clockOverhead(void) {
+  uint64_t best = UINT64_MAX;
+  for (int i = 0; i < 1000; i++) {
+    uint64_t start = now();
+    uint64_t took = now() - start;
+    if (took < best) {
+      best = took;
+    }
+  }
+  return best;
+}
+
+/**
+ * Runs each line of the file through the parser the given number of rounds,
+ * and prints the lines per second (of a round timed as a whole), the
+ * percentiles and the longest of the times of each line (in ns), and how many
+ * of the lines were rejected.
+ */
+static void run(char const *path, unsigned rounds, uint64_t overhead) {
+  unsigned count = readLines(path);
+  if (count == 0) {
+    return;
+  }
+
+  unsigned rejected = 0;
+  for (unsigned i = 0; i < count; i++) {
+    if (Bench_processCommand(lines[i].argc, lines[i].argv) != NULL) {
+      rejected++;
+    }
+  }
+
+  uint64_t start = now();
+  for (unsigned round = 0; round < rounds; round++) {
+    for (unsigned i = 0; i < count; i++) {
+      Bench_processCommand(lines[i].argc, lines[i].argv);
+    }
+  }
+  double seconds = (double)(now() - start) / 1e9;
+
+  size_t total = (size_t)count * rounds;
+  uint64_t *samples = malloc(total * sizeof(uint64_t));
+  if (samples == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+  for (size_t n = 0; n < total; n++) {
+    Line *line = &lines[n % count];
+    uint64_t before = now();
+    Bench_processCommand(line->argc, line->argv);
+    uint64_t took = now() - before;
+    samples[n] = (took > overhead) ? took - overhead : 0;
+  }
+  qsort(samples, total, sizeof(uint64_t), compareSamples);
+
+  // i.e. the name of the file, without its directory or extension
+  char const *name = strrchr(path, '/');
+  name = (name != NULL) ? name + 1 : path;
+  int length = (int)strcspn(name, ".");
+  printf("%-12.*s %10.0f %6llu %6llu %6llu %8llu %5u/%u\n", length, name,
+         (double)total / seconds,
+         (unsigned long long)samples[total / 2],
+         (unsigned long long)samples[total * 9 / 10],
+         (unsigned long long)samples[total * 99 / 100],
+         (unsigned long long)samples[total - 1], rejected, count);
+  free(samples);
+}
+
+int main(int argc, char **argv) {
+  unsigned rounds = ROUNDS_DEFAULT;
+  int first = 1;
+  if ((argc > 2) && (strcmp(argv[1], "-r") == 0)) {
+    rounds = (unsigned)atoi(argv[2]);
+    first = 3;
+  }
+  if ((first >= argc) || (rounds == 0)) {
+    fprintf(stderr, "usage: %s [-r rounds] lines.txt...\n", argv[0]);
+    return 1;
+  }
+
+  uint64_t overhead = clockOverhead();
+  for (int i = first; i < argc; i++) {
+    run(argv[i], rounds, overhead);
+  }
+  return 0;
+}
@@ -0,0 +1,124 @@
+"""Makes a synthetic CLI for the benchmarks
+
+Usage:
+  grammar.py <commands> <words_max> <output_dir> [--seed=<n>]
+
+Options:
+  --seed=<n>  Seed for the random choices, so that each run makes the same
+              CLI [default: 1]
+
+Writes, to the output_dir:
+  bench.docopt      the usage lines of the CLI (each of 1 to words_max command
+                    words, some positional arguments and options)
+  bench_handlers.c  a handler for each command, that does nothing
+  realistic.txt     a line for each command, with its arguments
+  adversarial.txt   lines that make the parser work hard for nothing, e.g. a
+                    command word with its last letter changed, a long
+                    argument that starts with a command word, an unknown
+                    option, or too many tokens
+"""
+
+import os.path
+import random
+import docopt
+
+# The command words are made of these, so that (like a real CLI) many of them
+# start the same way. NB: none of them can be a C keyword, or a name the
+# generated code already uses.
+SYLLABLES = ["ka", "lo", "mi", "nu", "pe", "ra", "si", "to", "vu", "xe"]
+
+PROMPT = "bench>"
+
+OPTIONS = """Options:
+  -h --help     Show this screen.
+  --verbose     Say more.
+  --times=<n>   How many times [default: 1].
+"""
+
+
+def make_words(count, rng):
+    """count different command words, each of two or three syllables"""
+    words = set()
+    while len(words) < count:
+        words.add("".join(rng.choice(SYLLABLES)
+                          for _ in range(rng.randint(2, 3))))
+    return sorted(words)
+
+
+def make_commands(count, words_max, rng):
+    """
+    count commands, each a list of 1 to words_max command words (no two with
+    the same words, as the opcode doesn't keep their order)
+    """
+    words = make_words(max(8, int(3 * count**0.5)), rng)
+    seen = set()
+    commands = []
+    while len(commands) < count:
+        parts = rng.sample(words, rng.randint(1, words_max))
+        if frozenset(parts) not in seen:
+            seen.add(frozenset(parts))
+            commands.append(parts)
+    return commands
+
+
+def function_name(parts):
+    """The name docopt-uc gives the handler of a command"""
+    return "".join(p.capitalize() for p in parts).replace("_", "")
+
+
+def main():
+    args = docopt.docopt(__doc__)
+    rng = random.Random(int(args['--seed']))
+    commands = make_commands(int(args['<commands>']), int(args['<words_max>']),
+                             rng)
+    # how many positional arguments each command takes
+    positional = [rng.randint(0, 2) for _ in commands]
+
+    usage = ["Usage:"]
+    for parts, count in zip(commands, positional):
+        usage.append("  {} {}{} [--verbose] [--times=<n>]".format(
+            PROMPT, " ".join(parts), "".join(" <a%d>" % i
+                                              for i in range(count))))
+    usage.append("  {} --help".format(PROMPT))
+
+    output_dir = args['<output_dir>']
+    with open(os.path.join(output_dir, "bench.docopt"), "w") as f:
+        f.write("\n".join(usage) + "\n\n" + OPTIONS)
+
+    with open(os.path.join(output_dir, "bench_handlers.c"), "w") as f:
+        f.write('#include "bench_autogen.h"\n\n#include <stddef.h>\n\n')
+        f.write('char const *Bench_handle_Help(BenchArgs *args) {\n'
+                '  return "help";\n}\n\n')
+        f.write('char const *Bench_handle_Error(BenchArgs *args) {\n'
+                '  return "error";\n}\n')
+        for parts in commands:
+            f.write('\nchar const *Bench_handle_{}(BenchArgs *args) {{\n'
+                    '  return NULL;\n}}\n'.format(function_name(parts)))
+
+    realistic = []
+    for parts, count in zip(commands, positional):
+        line = parts + [str(rng.randint(0, 999)) for _ in range(count)]
+        if rng.random() < 0.3:
+            line.append("--times={}".format(rng.randint(1, 9)))
+        if rng.random() < 0.2:
+            line.append("--verbose")
+        realistic.append(" ".join(line))
+    rng.shuffle(realistic)
+
+    adversarial = []
+    for parts, count in zip(commands, positional):
+        near = parts[:-1] + [parts[-1][:-1] + "z"]
+        adversarial.append(" ".join(near))
+        adversarial.append(" ".join(parts[:1] + [parts[0] * 8]))
+        adversarial.append(" ".join(parts + ["0"] * count + ["--verbosf"]))
+        adversarial.append(" ".join(list(reversed(parts)) + ["0"] * 20))
+    rng.shuffle(adversarial)
+
+    for name, lines in (("realistic", realistic), ("adversarial",
+                                                   adversarial)):
+        with open(os.path.join(output_dir, name + ".txt"), "w") as f:
+            f.write("\n".join(lines) + "\n")
+
+
+if __name__ == '__main__':
+    main()
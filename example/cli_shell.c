@@ -13,55 +13,170 @@
 #include <string.h>
 
 enum {
+  CHAR_CTRL_C = 0x03,
+  CHAR_CTRL_G = 0x07,
+  CHAR_CTRL_R = 0x12,
   CHAR_CARRIAGE_RETURN = 0x0d,
   CHAR_BELL = 0x07,
   CHAR_BACKSPACE = 0x08,
+  CHAR_TAB = 0x09,
   CHAR_DELETE = 0x7f,
   CHAR_SPACE = 0x20,
   CHAR_ESCAPE = 0x1b,
 };
 
 enum {
-  HISTORY_DEPTH = 4,
+  SEARCH_LENGTH_MAX = 16, // i.e. of what Ctrl-R is looking for
 };
 
 struct cliShell {
   FILE *out;
+  CliShell_flushFunc flush;
   CliShell_getPrompt getPrompt;
-  CliShell_processCommandFunc processCommand;
+  CliShell_processLineFunc processLine;
+  CliShell_lineChangedFunc lineChanged;
+  CliShell_lineEnteredFunc lineEntered;
+  CliShell_completeFunc complete;
+  CliShell_listCompletionsFunc listCompletions;
+  char const *pending;
+  CliShell_resumeFunc resume;
+  CliShell_cancelFunc cancel;
+  CliShell_processFrameFunc processFrame;
 
   char current[CLI_SHELL_COMMAND_LENGTH_MAX];
-  char history[HISTORY_DEPTH][CLI_SHELL_COMMAND_LENGTH_MAX];
-  int8_t currentHistoryDepth;
-  int8_t historyOffset;
-  uint8_t lastHistoryIdx;
   uint8_t escapeLen;
   char escapeSeq[5];
   char *appendAt;
+  bool lastWasTab; // i.e. so a second TAB lists the completions
+
+  // i.e. the past commands, oldest first, each followed by a NUL, in a ring
+  // (historyTail is the start of the oldest and historyHead the end of the
+  // newest). The indices run freely, as for the buffers below.
+  char history[CLI_SHELL_HISTORY_SIZE];
+  uint16_t historyHead;
+  uint16_t historyTail;
+  // i.e. the line is the entry at historyAt (from the up arrow or Ctrl-R),
+  // and recalled is where it is in the history, so it isn't copied into
+  // current until it is changed (or if it runs past the end of the ring)
+  bool browsing;
+  uint16_t historyAt;
+  char const *recalled;
+  uint8_t recalledLength;
+  // i.e. Ctrl-R, what it is looking for and the entry it has found
+  bool searching;
+  bool found;
+  char search[SEARCH_LENGTH_MAX];
+  uint8_t searchLength;
+
+  // NB: the indices run freely and are only masked when the buffer is indexed,
+  // so that txHead is only moved by the shell and txTail only by txDone
+  char txBuffer[CLI_SHELL_TX_BUFFER_SIZE];
+  uint16_t txHead;
+  uint16_t volatile txTail;
+
+  // i.e. a command is still running (a slice at a time), and the input that
+  // arrived meanwhile, which is kept the same way as the output (rxHead is
+  // only moved by CliShell_handleChar and rxTail only by CliShell_poll)
+  bool running;
+  char rxBuffer[CLI_SHELL_RX_BUFFER_SIZE];
+  uint16_t volatile rxHead;
+  uint16_t rxTail;
+
+  // i.e. a binary frame is arriving (its bytes after the magic byte so far),
+  // and the command that is running came from one, so its result is a reply
+  bool inFrame;
+  uint16_t frameLength;
+  uint8_t frame[CLI_SHELL_FRAME_MAX];
+  bool frameCommand;
 };
 
+static uint16_t txPendingLength(struct cliShell *cli) {
+  return (uint16_t)(cli->txHead - cli->txTail);
+}
+
+static uint16_t rxPendingLength(struct cliShell *cli) {
+  return (uint16_t)(cli->rxHead - cli->rxTail);
+}
+
+static void TxFlush(struct cliShell *cli) {
+  if (txPendingLength(cli) > 0) {
+    cli->flush(cli);
+  }
+}
+
+static void TxBytes(struct cliShell *cli, char const *data, size_t length) {
+  while (length > 0) {
+    uint16_t space = CLI_SHELL_TX_BUFFER_SIZE - txPendingLength(cli);
+    if (space == 0) {
+      // give the sink a chance to drain, and drop the rest if it has not
+      TxFlush(cli);
+      space = CLI_SHELL_TX_BUFFER_SIZE - txPendingLength(cli);
+      if (space == 0) {
+        return;
+      }
+    }
+
+    uint16_t at = cli->txHead % CLI_SHELL_TX_BUFFER_SIZE;
+    size_t chunk = CLI_SHELL_TX_BUFFER_SIZE - at; // i.e. up to the wrap
+    if (chunk > space) {
+      chunk = space;
+    }
+    if (chunk > length) {
+      chunk = length;
+    }
+    memcpy(&cli->txBuffer[at], data, chunk);
+    cli->txHead += (uint16_t)chunk;
+    data += chunk;
+    length -= chunk;
+  }
+}
+
 static void TxString(struct cliShell *cli, char const *const s) {
-  fprintf(cli->out, "%s", s);
+  TxBytes(cli, s, strlen(s));
 }
 
-static void TxChar(struct cliShell *cli, char c) { fprintf(cli->out, "%c", c); }
+static void TxChar(struct cliShell *cli, char c) { TxBytes(cli, &c, 1); }
+
+static void flushToFile(struct cliShell *cli) {
+  CliShell_TxSegment segments[2];
+  uint8_t count = CliShell_txPending(cli, segments);
+  size_t written = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    written += fwrite(segments[i].data, 1, segments[i].length, cli->out);
+  }
+  fflush(cli->out);
+  CliShell_txDone(cli, written);
+}
 
 static uint8_t getCurrentLineLength(struct cliShell *cli) {
+  if (cli->recalled != NULL) {
+    return cli->recalledLength;
+  }
   return (uint8_t)(cli->appendAt - cli->current);
 }
 
-static int8_t MIN(int8_t a, int8_t b) {
-  if (a < b)
-    return a;
-  else
-    return b;
+// i.e. the history entry it was recalled from (until it is changed), or
+// current
+static char const *getCurrentLine(struct cliShell *cli) {
+  return (cli->recalled != NULL) ? cli->recalled : cli->current;
+}
+
+static void writeCurrentLine(struct cliShell *cli) {
+  TxBytes(cli, getCurrentLine(cli), getCurrentLineLength(cli));
 }
 
-static int8_t MAX(int8_t a, int8_t b) {
-  if (a > b)
-    return a;
-  else
-    return b;
+/**
+ * Copies the line into current (if it is still the history entry it was
+ * recalled from), so that it can be changed.
+ */
+static void editCurrentLine(struct cliShell *cli) {
+  if (cli->recalled == NULL) {
+    return;
+  }
+  memcpy(cli->current, cli->recalled, cli->recalledLength);
+  cli->appendAt = &cli->current[cli->recalledLength];
+  *cli->appendAt = '\0';
+  cli->recalled = NULL;
 }
 
 static void clearTerminalLine(struct cliShell *cli) {
@@ -74,42 +189,275 @@ static void clearTerminalLine(struct cliShell *cli) {
   }
 }
 
-static void updateHistoryBuffers(struct cliShell *cli) {
-  if (strcmp(cli->history[cli->lastHistoryIdx], cli->current) == 0) {
-    // current command is same as the last one
+static char historyChar(struct cliShell *cli, uint16_t at) {
+  return cli->history[at % CLI_SHELL_HISTORY_SIZE];
+}
+
+static uint8_t historyEntryLength(struct cliShell *cli, uint16_t at) {
+  uint8_t length = 0;
+  while (historyChar(cli, at + length) != '\0') {
+    length++;
+  }
+  return length;
+}
+
+// The start of the entry that at is in (or the NUL of)
+static uint16_t historyEntryStart(struct cliShell *cli, uint16_t at) {
+  while ((at != cli->historyTail) && (historyChar(cli, at - 1) != '\0')) {
+    at--;
+  }
+  return at;
+}
+
+static bool isNewestHistoryEntry(struct cliShell *cli, uint16_t at) {
+  return (cli->historyHead != cli->historyTail) &&
+         (at == historyEntryStart(cli, cli->historyHead - 1));
+}
+
+static void updateHistoryBuffers(struct cliShell *cli, char const *line,
+                                 uint8_t len) {
+  if ((len + 1 > CLI_SHELL_HISTORY_SIZE) || (len == 0)) {
     return;
   }
-  cli->currentHistoryDepth++;
-  cli->currentHistoryDepth = MIN(cli->currentHistoryDepth, HISTORY_DEPTH);
-  cli->lastHistoryIdx = (cli->lastHistoryIdx + 1) % HISTORY_DEPTH;
-  strcpy(cli->history[cli->lastHistoryIdx], cli->current);
+  if (cli->historyHead != cli->historyTail) {
+    uint16_t newest = historyEntryStart(cli, cli->historyHead - 1);
+    uint8_t i = 0;
+    while ((i < len) && (historyChar(cli, newest + i) == line[i])) {
+      i++;
+    }
+    if ((i == len) && (historyChar(cli, newest + len) == '\0')) {
+      // current command is same as the last one
+      return;
+    }
+  }
+
+  // i.e. the oldest commands are dropped until there is room for it (and its
+  // NUL)
+  while ((uint16_t)(cli->historyHead - cli->historyTail) >
+         CLI_SHELL_HISTORY_SIZE - (len + 1)) {
+    cli->historyTail += historyEntryLength(cli, cli->historyTail) + 1;
+  }
+  for (uint8_t i = 0; i < len; i++) {
+    cli->history[cli->historyHead++ % CLI_SHELL_HISTORY_SIZE] = line[i];
+  }
+  cli->history[cli->historyHead++ % CLI_SHELL_HISTORY_SIZE] = '\0';
+}
+
+static void lineChanged(struct cliShell *cli, uint8_t changedFrom) {
+  if (cli->lineChanged != NULL) {
+    cli->lineChanged(getCurrentLine(cli), getCurrentLineLength(cli),
+                     changedFrom);
+  }
 }
 
 static void writePrompt(struct cliShell *cli) {
   TxString(cli, cli->getPrompt());
 }
 
+static void writeReply(struct cliShell *cli, char const *err) {
+  uint8_t status = (err != NULL) ? DOCOPT_BINARY_FAILED : DOCOPT_BINARY_DONE;
+  size_t errLength = (err != NULL) ? strlen(err) : 0;
+  // i.e. the status and the error have to fit in the frame
+  if (errLength > DOCOPT_BINARY_FRAME_MAX - 4) {
+    errLength = DOCOPT_BINARY_FRAME_MAX - 4;
+  }
+  uint8_t header[3] = {DOCOPT_BINARY_MAGIC, (uint8_t)(1 + errLength), status};
+  uint16_t crc = Docopt_crc16(DOCOPT_CRC16_INIT, &header[1], 2);
+  crc = Docopt_crc16(crc, (uint8_t const *)err, (uint8_t)errLength);
+  char const crcBytes[2] = {(char)(crc & 0xff), (char)(crc >> 8)};
+  TxBytes(cli, (char const *)header, sizeof(header));
+  TxBytes(cli, err, errLength);
+  TxBytes(cli, crcBytes, sizeof(crcBytes));
+}
+
+static void endCommand(struct cliShell *cli, char const *err) {
+  if (cli->frameCommand) {
+    cli->frameCommand = false;
+    writeReply(cli, err);
+    return;
+  }
+  if (err) {
+    TxString(cli, "Error: ");
+    TxString(cli, err);
+    TxString(cli, "\r\n");
+  }
+  writePrompt(cli);
+}
+
 static void clearCurrentCommand(struct cliShell *cli) {
   memset(cli->current, 0, sizeof(cli->current));
   cli->appendAt = cli->current;
+  cli->recalled = NULL;
+  cli->browsing = false;
+  lineChanged(cli, 0);
+}
+
+/**
+ * Makes the history entry at `at` the line, where it is in the history
+ * (unless it, or its NUL, runs past the end of the ring, when it is copied
+ * into current).
+ */
+static void recallHistory(struct cliShell *cli, uint16_t at) {
+  uint8_t length = historyEntryLength(cli, at);
+  uint16_t offset = at % CLI_SHELL_HISTORY_SIZE;
+  cli->browsing = true;
+  cli->historyAt = at;
+  if (offset + length < CLI_SHELL_HISTORY_SIZE) {
+    cli->recalled = &cli->history[offset];
+    cli->recalledLength = length;
+  } else {
+    cli->recalled = NULL;
+    for (uint8_t i = 0; i < length; i++) {
+      cli->current[i] = historyChar(cli, at + i);
+    }
+    cli->appendAt = &cli->current[length];
+    *cli->appendAt = '\0';
+  }
+  lineChanged(cli, 0);
 }
 
 static void replaceCurrentCommandWithHistory(struct cliShell *cli,
                                              int8_t offsetDirection) {
-  cli->historyOffset += offsetDirection;
-  cli->historyOffset = MAX(cli->historyOffset, -1);
-  if (cli->historyOffset == -1) {
+  if (offsetDirection > 0) {
+    if (cli->historyHead == cli->historyTail) {
+      return;
+    }
+    uint16_t at = cli->historyAt;
+    if (!cli->browsing) {
+      at = historyEntryStart(cli, cli->historyHead - 1);
+    } else if (at != cli->historyTail) {
+      at = historyEntryStart(cli, at - 1);
+    }
+    recallHistory(cli, at);
+    return;
+  }
+
+  if (!cli->browsing || isNewestHistoryEntry(cli, cli->historyAt)) {
     clearCurrentCommand(cli);
     return;
   }
-  cli->historyOffset = MIN(cli->historyOffset, cli->currentHistoryDepth - 1);
+  // i.e. the entry after it
+  recallHistory(cli,
+                cli->historyAt + historyEntryLength(cli, cli->historyAt) + 1);
+}
+
+static bool searchMatchesAt(struct cliShell *cli, uint16_t at) {
+  for (uint8_t i = 0; i < cli->searchLength; i++) {
+    if (historyChar(cli, at + i) != cli->search[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Finds the newest history entry with what Ctrl-R is looking for in it
+ * (starting before end), and makes it the line.
+ *
+ * NB: This goes back through the ring a character at a time, rather than an
+ *     entry at a time, as a match can't run across the NUL between entries.
+ */
+static bool searchHistory(struct cliShell *cli, uint16_t end) {
+  uint16_t count = (uint16_t)(end - cli->historyTail);
+  for (uint16_t back = 1; back <= count; back++) {
+    uint16_t at = end - back;
+    if ((historyChar(cli, at) == cli->search[0]) && searchMatchesAt(cli, at)) {
+      recallHistory(cli, historyEntryStart(cli, at));
+      return true;
+    }
+  }
+  return false;
+}
 
-  uint8_t idx = (cli->lastHistoryIdx + (HISTORY_DEPTH - cli->historyOffset)) %
-                HISTORY_DEPTH;
-  strcpy(cli->current, cli->history[idx]);
+static void writeSearch(struct cliShell *cli) {
+  TxString(cli, "\r\x1b[0K(reverse-i-search)`");
+  TxBytes(cli, cli->search, cli->searchLength);
+  TxString(cli, "': ");
+  writeCurrentLine(cli);
+}
+
+static void endSearch(struct cliShell *cli) {
+  cli->searching = false;
+  TxString(cli, "\r\x1b[0K");
+  writePrompt(cli);
+  writeCurrentLine(cli);
+}
 
-  // establish new append point
-  cli->appendAt = cli->current + strlen((char const *)cli->current);
+/**
+ * Handles a character while Ctrl-R is looking through the history: a
+ * character to look for, Backspace, Ctrl-R again for an older entry, or
+ * Ctrl-G (or Ctrl-C) to give up.
+ *
+ * Returns false for any other character (e.g. Enter), which ends the search
+ * with the entry it found as the line, and is then handled as usual.
+ */
+static bool handleSearchChar(struct cliShell *cli, char c) {
+  if (c == CHAR_CTRL_R) {
+    if (!cli->found || !searchHistory(cli, cli->historyAt)) {
+      TxChar(cli, CHAR_BELL);
+    }
+  } else if ((c == CHAR_BACKSPACE) || (c == CHAR_DELETE)) {
+    if (cli->searchLength > 0) {
+      cli->searchLength--;
+    }
+    // i.e. the newest entry with what is left in it
+    cli->found = (cli->searchLength > 0) &&
+                 searchHistory(cli, cli->historyHead);
+    if (!cli->found) {
+      clearCurrentCommand(cli);
+    }
+  } else if ((c == CHAR_CTRL_G) || (c == CHAR_CTRL_C)) {
+    clearCurrentCommand(cli);
+    endSearch(cli);
+    return true;
+  } else if ((c >= CHAR_SPACE) && (c < CHAR_DELETE)) {
+    // i.e. the entry found so far is looked at again, with c added
+    uint16_t end = cli->historyHead;
+    if (cli->found) {
+      end = cli->historyAt + historyEntryLength(cli, cli->historyAt);
+    }
+    if (cli->searchLength < sizeof(cli->search)) {
+      cli->search[cli->searchLength++] = c;
+      if (searchHistory(cli, end)) {
+        cli->found = true;
+      } else {
+        cli->searchLength--;
+        TxChar(cli, CHAR_BELL);
+      }
+    } else {
+      TxChar(cli, CHAR_BELL);
+    }
+  } else {
+    return false;
+  }
+  writeSearch(cli);
+  return true;
+}
+
+static void completeCurrentCommand(struct cliShell *cli, uint8_t len) {
+  if (cli->complete == NULL) {
+    TxChar(cli, CHAR_BELL);
+    return;
+  }
+
+  uint8_t room = sizeof(cli->current) - 1 - len;
+  uint8_t added = cli->complete(cli->current, len, cli->appendAt, room);
+  if (added > 0) {
+    TxBytes(cli, cli->appendAt, added);
+    cli->appendAt += added;
+    *cli->appendAt = '\0';
+    lineChanged(cli, len);
+  } else if (cli->lastWasTab && (cli->listCompletions != NULL)) {
+    TxString(cli, "\r\n");
+    // i.e. the list is written by listCompletions, so it must follow this
+    TxFlush(cli);
+    cli->listCompletions(cli->current, len);
+    TxString(cli, "\r\n");
+    writePrompt(cli);
+    TxBytes(cli, cli->current, len);
+  } else {
+    TxChar(cli, CHAR_BELL);
+  }
 }
 
 static uint8_t handleEscapeSequence(struct cliShell *cli, uint8_t escapeLen,
@@ -131,7 +479,7 @@ static uint8_t handleEscapeSequence(struct cliShell *cli, uint8_t escapeLen,
       // up arrow: ESC A, down arrow: ESC B
       clearTerminalLine(cli);
       replaceCurrentCommandWithHistory(cli, escapeSeq[1] == 'A' ? 1 : -1);
-      TxString(cli, cli->current);
+      writeCurrentLine(cli);
       return 0;
     }
 
@@ -147,12 +495,12 @@ static uint8_t handleEscapeSequence(struct cliShell *cli, uint8_t escapeLen,
     // up arrow: ESC [ A
     clearTerminalLine(cli);
     replaceCurrentCommandWithHistory(cli, 1);
-    TxString(cli, cli->current);
+    writeCurrentLine(cli);
   } else if (strcmp("\x1b[B", escapeSeq) == 0) {
     // up arrow: ESC [ B
     clearTerminalLine(cli);
     replaceCurrentCommandWithHistory(cli, -1);
-    TxString(cli, cli->current);
+    writeCurrentLine(cli);
   } else {
     // this is an unsupported escape code
     TxChar(cli, CHAR_BELL);
@@ -169,9 +517,70 @@ static uint8_t handleEscapeSequence(struct cliShell *cli, uint8_t escapeLen,
   return 0;
 }
 
-enum CliShell_Error CliShell_handleChar(struct cliShell *cli, char c) {
-  uint8_t len = getCurrentLineLength(cli);
+static char const *processLine(struct cliShell *cli, char const *line,
+                               uint8_t len) {
+  // tokenise
+  // NB: the tokens are slices of the line, which is left as it is
+  DocoptSlice tokens[CLI_SHELL_COMMAND_MAX_TOKENS];
+  uint8_t tokenCount = 0;
+  enum DocoptError tokenError = Docopt_tokenize(
+      line, len, tokens, CLI_SHELL_COMMAND_MAX_TOKENS, &tokenCount);
+
+  if (tokenError == DOCOPT_ERROR_TOO_MANY_TOKENS) {
+    return "Too many tokens";
+  } else if (tokenError != DOCOPT_NO_ERROR) {
+    return "Unterminated quote";
+  } else if (tokenCount == 0) {
+    return "No command";
+  }
+  return cli->processLine(line, tokens, tokenCount);
+}
+
+static void handleFrameByte(struct cliShell *cli, uint8_t byte) {
+  if (cli->frameLength < CLI_SHELL_FRAME_MAX) {
+    cli->frame[cli->frameLength] = byte;
+  }
+  cli->frameLength++;
+  // i.e. its length, then that many bytes of the command, then its CRC
+  if (cli->frameLength < 1 + cli->frame[0] + 2) {
+    return;
+  }
+
+  cli->inFrame = false;
+  cli->frameCommand = true;
+  char const *err = "Frame too long";
+  if (cli->frameLength <= CLI_SHELL_FRAME_MAX) {
+    // i.e. the handlers write their own output, so it must follow the shell's
+    TxFlush(cli);
+    err = cli->processFrame(cli->frame, (uint8_t)cli->frameLength);
+  }
+  if ((cli->pending != NULL) && (err == cli->pending)) {
+    cli->running = true;
+  } else {
+    endCommand(cli, err);
+  }
+}
+
+static enum CliShell_Error handleChar(struct cliShell *cli, char c) {
+  if (cli->inFrame) {
+    handleFrameByte(cli, (uint8_t)c);
+    return CLI_SHELL_SUCCESS;
+  }
+
+  if ((c == DOCOPT_BINARY_MAGIC) && (cli->processFrame != NULL)) {
+    cli->inFrame = true;
+    cli->frameLength = 0;
+    return CLI_SHELL_SUCCESS;
+  }
+
+  if (cli->searching) {
+    if (handleSearchChar(cli, c)) {
+      return CLI_SHELL_SUCCESS;
+    }
+    endSearch(cli);
+  }
 
+  uint8_t len = getCurrentLineLength(cli);
   if (cli->escapeLen > 0) {
     cli->escapeSeq[cli->escapeLen++] = c;
     cli->escapeSeq[cli->escapeLen] = 0; // force null termination
@@ -187,57 +596,72 @@ enum CliShell_Error CliShell_handleChar(struct cliShell *cli, char c) {
   // , as first character is alternative "history" command
   if (c == ',' && len == 0) {
     replaceCurrentCommandWithHistory(cli, 1);
-    TxString(cli, cli->current);
+    writeCurrentLine(cli);
+    return CLI_SHELL_SUCCESS;
+  }
+
+  if (c == CHAR_CTRL_R) {
+    // i.e. look back through the history for what is typed next
+    cli->searching = true;
+    cli->found = false;
+    cli->searchLength = 0;
+    clearCurrentCommand(cli);
+    writeSearch(cli);
     return CLI_SHELL_SUCCESS;
   }
 
-  cli->historyOffset = -1;
+  cli->browsing = false;
   if (c == CHAR_CARRIAGE_RETURN) {
-    *cli->appendAt = '\0'; // terminate string
-    // If there is actually text, then save it
-    if (len > 0) {
-      updateHistoryBuffers(cli);
+    if ((cli->recalled != NULL) &&
+        !isNewestHistoryEntry(cli, cli->historyAt)) {
+      // i.e. it is added to the history again, which could write over it
+      editCurrentLine(cli);
     }
-
-    // tokenise
-    // an extra one to detect "too many"
-    char *tokens[CLI_SHELL_COMMAND_MAX_TOKENS + 1];
-    uint8_t tokenCount = 0;
-    tokens[tokenCount] = strtok(cli->current, " ");
-    while (tokenCount < (CLI_SHELL_COMMAND_MAX_TOKENS + 1) &&
-           tokens[tokenCount] != NULL) {
-      tokens[++tokenCount] = strtok(NULL, " ");
+    if (cli->recalled == NULL) {
+      *cli->appendAt = '\0'; // terminate string
     }
+    char const *line = getCurrentLine(cli);
+    // If there is actually text, then save it
+    updateHistoryBuffers(cli, line, len);
 
     TxChar(cli, CHAR_CARRIAGE_RETURN);
     TxChar(cli, '\n');
+    // i.e. the handlers write their own output, so it must follow the echo
+    TxFlush(cli);
     char const *err = NULL;
-    if (tokenCount == 0) {
+    if (cli->lineEntered == NULL) {
+      err = processLine(cli, line, len);
+    } else if (len == 0) {
       err = "No command";
-    } else if (tokenCount > CLI_SHELL_COMMAND_MAX_TOKENS) {
-      err = "Too many tokens";
     } else {
-      err = cli->processCommand(tokenCount, tokens);
-    }
-
-    if (err) {
-      TxString(cli, "Error: ");
-      TxString(cli, err);
-      TxString(cli, "\r\n");
+      // i.e. the line has already been tokenized while it was typed
+      err = cli->lineEntered(line, len);
     }
 
     memset(cli->current, 0, sizeof(cli->current));
     cli->appendAt = &cli->current[0];
-    writePrompt(cli);
+    cli->recalled = NULL;
+    if ((cli->pending != NULL) && (err == cli->pending)) {
+      // i.e. CliShell_poll runs the rest of it, and then writes the prompt
+      cli->running = true;
+    } else {
+      endCommand(cli, err);
+    }
+  } else if (c == CHAR_TAB) {
+    editCurrentLine(cli);
+    completeCurrentCommand(cli, len);
   } else if (c == CHAR_BACKSPACE || c == CHAR_DELETE) {
     // check if we are beyond the first char
     if (len > 0) {
+      editCurrentLine(cli);
       cli->appendAt--;
       // get rid of the last character by overwriting with a ' '
       // NB: 0x08 is Backspace
       TxString(cli, "\x08 \x08");
+      lineChanged(cli, len - 1);
     }
   } else {
+    editCurrentLine(cli);
     if (len >= sizeof(cli->current) - 1) {
       cli->appendAt--;
       // Chime if the Command buffer is full
@@ -248,29 +672,105 @@ enum CliShell_Error CliShell_handleChar(struct cliShell *cli, char c) {
 
     *cli->appendAt++ = c;
     TxChar(cli, c); // echo to the user
+    lineChanged(cli, getCurrentLineLength(cli) - 1);
   }
   return CLI_SHELL_SUCCESS;
 }
 
+static void cancelCommand(struct cliShell *cli) {
+  TxString(cli, "^C\r\n");
+  // i.e. the handler may write its own output as it tidies up
+  TxFlush(cli);
+  char const *err = cli->cancel();
+  cli->running = false;
+  // i.e. nothing that was typed while it ran is run either
+  cli->rxTail = cli->rxHead;
+  endCommand(cli, err);
+}
+
+enum CliShell_Error CliShell_handleChar(struct cliShell *cli, char c) {
+  if (cli->running && (c == CHAR_CTRL_C)) {
+    cancelCommand(cli);
+    TxFlush(cli);
+    return CLI_SHELL_SUCCESS;
+  }
+  if (cli->running || (rxPendingLength(cli) > 0)) {
+    // i.e. kept until the command is done (and after what was kept before it)
+    if (rxPendingLength(cli) < CLI_SHELL_RX_BUFFER_SIZE) {
+      cli->rxBuffer[cli->rxHead % CLI_SHELL_RX_BUFFER_SIZE] = c;
+      cli->rxHead++;
+    }
+    return CLI_SHELL_SUCCESS;
+  }
+
+  enum CliShell_Error err = handleChar(cli, c);
+  cli->lastWasTab = (c == CHAR_TAB);
+  // i.e. all of the output for this character goes out as one write
+  TxFlush(cli);
+  return err;
+}
+
+bool CliShell_poll(struct cliShell *cli) {
+  if (cli->running) {
+    // i.e. the handler writes its own output, so it must follow the shell's
+    TxFlush(cli);
+    char const *err = cli->resume();
+    if (err == cli->pending) {
+      return true;
+    }
+    cli->running = false;
+    endCommand(cli, err);
+    TxFlush(cli);
+  }
+
+  // i.e. handle what was typed while it ran, until another command is running
+  while (!cli->running && (rxPendingLength(cli) > 0)) {
+    char c = cli->rxBuffer[cli->rxTail % CLI_SHELL_RX_BUFFER_SIZE];
+    cli->rxTail++;
+    handleChar(cli, c);
+    cli->lastWasTab = (c == CHAR_TAB);
+    TxFlush(cli);
+  }
+  return cli->running;
+}
+
 void CliShell_start(struct cliShell *cli) {
   FILE *outfp = cli->out;
+  CliShell_flushFunc flush = cli->flush;
   CliShell_getPrompt getPrompt = cli->getPrompt;
-  CliShell_processCommandFunc processCommand = cli->processCommand;
+  CliShell_processLineFunc processLine = cli->processLine;
+  CliShell_lineChangedFunc lineChanged = cli->lineChanged;
+  CliShell_lineEnteredFunc lineEntered = cli->lineEntered;
+  CliShell_completeFunc complete = cli->complete;
+  CliShell_listCompletionsFunc listCompletions = cli->listCompletions;
+  char const *pending = cli->pending;
+  CliShell_resumeFunc resume = cli->resume;
+  CliShell_cancelFunc cancel = cli->cancel;
+  CliShell_processFrameFunc processFrame = cli->processFrame;
   memset(cli, 0, sizeof(struct cliShell));
   cli->out = outfp;
+  cli->flush = flush;
   cli->getPrompt = getPrompt;
-  cli->processCommand = processCommand;
-  cli->historyOffset = -1;
+  cli->processLine = processLine;
+  cli->lineChanged = lineChanged;
+  cli->lineEntered = lineEntered;
+  cli->complete = complete;
+  cli->listCompletions = listCompletions;
+  cli->pending = pending;
+  cli->resume = resume;
+  cli->cancel = cancel;
+  cli->processFrame = processFrame;
   cli->appendAt = &cli->current[0];
 
   TxString(cli, "\r\nCLI starting ...\r\n");
   writePrompt(cli);
+  TxFlush(cli);
 }
 
 struct cliShell *CliShell_alloc(CliShell_getPrompt getPrompt,
-                                CliShell_processCommandFunc processCommand,
+                                CliShell_processLineFunc processLine,
                                 FILE *outfp) {
-  if ((getPrompt == NULL) || processCommand == NULL) {
+  if ((getPrompt == NULL) || processLine == NULL) {
     return NULL;
   }
 
@@ -279,9 +779,149 @@ struct cliShell *CliShell_alloc(CliShell_getPrompt getPrompt,
     return NULL;
   }
 
-  cli->historyOffset = -1;
+  cli->historyHead = 0;
+  cli->historyTail = 0;
+  cli->browsing = false;
+  cli->recalled = NULL;
+  cli->searching = false;
   cli->out = outfp;
+  cli->flush = flushToFile;
+  cli->txHead = 0;
+  cli->txTail = 0;
   cli->getPrompt = getPrompt;
-  cli->processCommand = processCommand;
+  cli->processLine = processLine;
+  cli->lineChanged = NULL;
+  cli->lineEntered = NULL;
+  cli->complete = NULL;
+  cli->listCompletions = NULL;
+  cli->pending = NULL;
+  cli->resume = NULL;
+  cli->cancel = NULL;
+  cli->running = false;
+  cli->rxHead = 0;
+  cli->rxTail = 0;
+  cli->processFrame = NULL;
+  cli->inFrame = false;
+  cli->frameCommand = false;
   return cli;
 }
+
+void CliShell_setStreaming(struct cliShell *cli,
+                           CliShell_lineChangedFunc lineChanged,
+                           CliShell_lineEnteredFunc lineEntered) {
+  cli->lineChanged = lineChanged;
+  cli->lineEntered = lineEntered;
+}
+
+void CliShell_setCompletion(struct cliShell *cli, CliShell_completeFunc complete,
+                            CliShell_listCompletionsFunc listCompletions) {
+  cli->complete = complete;
+  cli->listCompletions = listCompletions;
+}
+
+void CliShell_setResumable(struct cliShell *cli, char const *pending,
+                           CliShell_resumeFunc resume,
+                           CliShell_cancelFunc cancel) {
+  cli->pending = pending;
+  cli->resume = resume;
+  cli->cancel = cancel;
+}
+
+void CliShell_setBinary(struct cliShell *cli,
+                        CliShell_processFrameFunc processFrame) {
+  cli->processFrame = processFrame;
+}
+
+bool CliShell_inFrame(struct cliShell *cli) { return cli->inFrame; }
+
+void CliShell_setOutput(struct cliShell *cli, CliShell_flushFunc flush) {
+  cli->flush = (flush != NULL) ? flush : flushToFile;
+}
+
+uint8_t CliShell_txPending(struct cliShell *cli,
+                           CliShell_TxSegment segments[2]) {
+  uint16_t length = txPendingLength(cli);
+  if (length == 0) {
+    return 0;
+  }
+
+  uint16_t at = cli->txTail % CLI_SHELL_TX_BUFFER_SIZE;
+  uint16_t first = CLI_SHELL_TX_BUFFER_SIZE - at; // i.e. up to the wrap
+  segments[0].data = &cli->txBuffer[at];
+  if (length <= first) {
+    segments[0].length = length;
+    return 1;
+  }
+  segments[0].length = first;
+  segments[1].data = &cli->txBuffer[0];
+  segments[1].length = length - first;
+  return 2;
+}
+
+void CliShell_txDone(struct cliShell *cli, size_t length) {
+  uint16_t pending = txPendingLength(cli);
+  cli->txTail += (uint16_t)((length < pending) ? length : pending);
+}
+
+size_t CliShell_executeBuffer(struct cliShell *cli, char const *buf, size_t len,
+                              bool stopOnError,
+                              CliShell_lineResultFunc lineResult) {
+  if (cli->running) {
+    // i.e. see CliShell_poll
+    return SIZE_MAX;
+  }
+
+  size_t failures = 0;
+  size_t lineNumber = 0;
+  char const *end = buf + len;
+
+  while (buf < end) {
+    char const *eol = memchr(buf, '\n', (size_t)(end - buf));
+    if (eol == NULL) {
+      eol = end;
+    }
+    char const *line = buf;
+    size_t lineLength = (size_t)(eol - buf);
+    // i.e. not past the end, when the last line has no newline
+    buf = (eol < end) ? eol + 1 : end;
+    lineNumber++;
+
+    // i.e. accept CR LF line endings too
+    if ((lineLength > 0) && (line[lineLength - 1] == CHAR_CARRIAGE_RETURN)) {
+      lineLength--;
+    }
+    while ((lineLength > 0) && ((*line == CHAR_SPACE) || (*line == '\t'))) {
+      line++;
+      lineLength--;
+    }
+    if ((lineLength == 0) || (*line == '#')) {
+      // blank lines and comments are skipped
+      continue;
+    }
+
+    // NB: the lines are processed where they are, so there is no copy and
+    // nothing is echoed
+    char const *err = NULL;
+    if (lineLength > UINT8_MAX) {
+      // i.e. the tokens are slices of it, with byte offsets
+      err = "Line too long";
+    } else {
+      err = processLine(cli, line, (uint8_t)lineLength);
+    }
+    while ((cli->pending != NULL) && (err == cli->pending)) {
+      // i.e. a script waits for each command to be done
+      err = cli->resume();
+    }
+
+    if (lineResult != NULL) {
+      lineResult(lineNumber, err);
+    }
+    if (err) {
+      failures++;
+      if (stopOnError) {
+        break;
+      }
+    }
+  }
+  return failures;
+}
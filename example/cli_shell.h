@@ -1,12 +1,19 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 
+#include "docopt_tokenize.h"
+
 enum {
   CLI_SHELL_COMMAND_LENGTH_MAX = 50, // i.e. max character length
   CLI_SHELL_COMMAND_MAX_TOKENS = 15, // i.e. max separate tokens (' ' delimited)
+  CLI_SHELL_TX_BUFFER_SIZE = 256,    // i.e. output bytes held for the sink
+  CLI_SHELL_RX_BUFFER_SIZE = 64,     // i.e. input bytes held while a command runs
+  CLI_SHELL_FRAME_MAX = 64,          // i.e. the longest binary frame (at most 255)
+  CLI_SHELL_HISTORY_SIZE = 128,      // i.e. bytes of past commands, each as long as it is
 };
 
 enum CliShell_Error {
@@ -18,10 +25,130 @@ enum CliShell_Error {
 struct cliShell;
 
 typedef char const *(*CliShell_getPrompt)();
-typedef char const *(*CliShell_processCommandFunc)(uint8_t argc, char **argv);
+typedef char const *(*CliShell_processLineFunc)(char const *line,
+                                                DocoptSlice const *slices,
+                                                uint8_t count);
 
 struct cliShell *CliShell_alloc(CliShell_getPrompt getPrompt,
-                                CliShell_processCommandFunc processCommand,
+                                CliShell_processLineFunc processLine,
                                 FILE *outfp);
+
+typedef struct {
+  char const *data;
+  size_t length;
+} CliShell_TxSegment;
+
+typedef void (*CliShell_flushFunc)(struct cliShell *cli);
+
+/**
+ * The shell's output is held in a ring buffer and handed to flush once per
+ * event (e.g. once per character handled), rather than written a character at
+ * a time. flush gets the pending output with CliShell_txPending and releases
+ * it with CliShell_txDone, either before it returns or later (e.g. from the
+ * interrupt at the end of a DMA transfer). If the buffer fills, flush is
+ * called early and anything that still does not fit is dropped.
+ *
+ * By default (or if flush is NULL) the output is written to outfp.
+ */
+void CliShell_setOutput(struct cliShell *cli, CliShell_flushFunc flush);
+
+// Returns the number of segments (0, 1 or 2, as the buffer may wrap) that
+// make up the pending output, i.e. the vector to write
+uint8_t CliShell_txPending(struct cliShell *cli,
+                           CliShell_TxSegment segments[2]);
+void CliShell_txDone(struct cliShell *cli, size_t length);
+
+typedef void (*CliShell_lineChangedFunc)(char const *line, uint8_t length,
+                                         uint8_t changedFrom);
+typedef char const *(*CliShell_lineEnteredFunc)(char const *line,
+                                                uint8_t length);
+
+/**
+ * Gives the line to lineChanged each time it changes while it is typed (so the
+ * work of parsing it can be done as the characters arrive), and to
+ * lineEntered instead of processLine when Enter is pressed.
+ */
+void CliShell_setStreaming(struct cliShell *cli,
+                           CliShell_lineChangedFunc lineChanged,
+                           CliShell_lineEnteredFunc lineEntered);
+typedef uint8_t (*CliShell_completeFunc)(char const *line, uint8_t length,
+                                        char *completion, uint8_t size);
+typedef void (*CliShell_listCompletionsFunc)(char const *line, uint8_t length);
+
+/**
+ * TAB adds whatever complete gives (at most size characters) to the end of the
+ * line, e.g. the rest of a command word. If it gives nothing, a second TAB
+ * lists what could come next with listCompletions (which writes its own
+ * output), and the prompt and line are written again after it.
+ */
+void CliShell_setCompletion(struct cliShell *cli, CliShell_completeFunc complete,
+                            CliShell_listCompletionsFunc listCompletions);
+typedef char const *(*CliShell_resumeFunc)(void);
+typedef char const *(*CliShell_cancelFunc)(void);
+
+/**
+ * Lets a command that returns pending (e.g. NAVALFATE_PENDING) carry on after
+ * Enter, a slice at a time: each CliShell_poll calls resume for its next
+ * slice, until it returns anything else. Meanwhile the characters given to
+ * CliShell_handleChar are kept (until CLI_SHELL_RX_BUFFER_SIZE of them, after
+ * which they are dropped) to be handled once it is done, except for Ctrl-C,
+ * which cancels it (and drops them).
+ */
+void CliShell_setResumable(struct cliShell *cli, char const *pending,
+                           CliShell_resumeFunc resume,
+                           CliShell_cancelFunc cancel);
+typedef char const *(*CliShell_processFrameFunc)(uint8_t const *frame,
+                                                 uint8_t length);
+
+/**
+ * DOCOPT_BINARY_MAGIC switches the input to binary for one frame (see
+ * docopt_tokenize.h), of at most CLI_SHELL_FRAME_MAX bytes, which is given to
+ * processFrame (e.g. Navalfate_processFrame) once it is all there. Nothing is
+ * echoed, and the result is written as a reply frame (after any output of the
+ * handler) rather than as text, and without a prompt. The line being typed
+ * (if any) is kept as it was.
+ *
+ * NB: Wait for the reply to a frame before sending the next one, as a byte of
+ *     it could be taken for Ctrl-C while a resumable command is running.
+ */
+void CliShell_setBinary(struct cliShell *cli,
+                        CliShell_processFrameFunc processFrame);
+
+// Returns true while a frame is arriving, i.e. its bytes aren't characters
+// (e.g. for a caller that takes some of them to be signals)
+bool CliShell_inFrame(struct cliShell *cli);
 void CliShell_start(struct cliShell *cli);
 enum CliShell_Error CliShell_handleChar(struct cliShell *cli, char c);
+
+/**
+ * Runs the next slice of the command that is running (if there is one), and
+ * once it is done handles the characters that were kept meanwhile.
+ *
+ * Returns true while a command is running, i.e. call it again soon (rather
+ * than waiting for the next character).
+ */
+bool CliShell_poll(struct cliShell *cli);
+
+// err is NULL if the line succeeded
+typedef void (*CliShell_lineResultFunc)(size_t lineNumber, char const *err);
+
+/**
+ * Runs each newline separated command in buf, without the echo, prompt or
+ * history of CliShell_handleChar. Blank lines and lines starting with '#' are
+ * skipped, lineResult (if not NULL) is given the result of every other line
+ * (once it is done, for a resumable command), and if stopOnError is set
+ * nothing after the first failed line is run.
+ *
+ * NB: A resumable command is run until it is done before the next line, and
+ *     can't be cancelled meanwhile, as no characters are handled.
+ * NB: As the lines are parsed where they are, they aren't limited to
+ *     CLI_SHELL_COMMAND_LENGTH_MAX (which is the room for a typed line), but
+ *     a line of more than 255 characters fails as "Line too long".
+ *
+ * Returns the number of lines that failed, or SIZE_MAX (having run none of
+ * them) if a command typed into the shell is still running, as the lines
+ * would be parsed into the context that it is using.
+ */
+size_t CliShell_executeBuffer(struct cliShell *cli, char const *buf, size_t len,
+                              bool stopOnError,
+                              CliShell_lineResultFunc lineResult);
@@ -0,0 +1,91 @@
+#include "docopt_tokenize.h"
+
+static bool isSpace(char c) { return (c == ' ') || (c == '\t'); }
+
+enum DocoptError Docopt_tokenize(char const *line, uint8_t length,
+                                 DocoptSlice *slices, uint8_t maxSlices,
+                                 uint8_t *count) {
+  uint8_t i = 0;
+  *count = 0;
+
+  while (true) {
+    while ((i < length) && isSpace(line[i])) {
+      i++;
+    }
+    if ((i >= length) || (line[i] == '\0')) {
+      return DOCOPT_NO_ERROR;
+    }
+    if (*count >= maxSlices) {
+      return DOCOPT_ERROR_TOO_MANY_TOKENS;
+    }
+
+    uint8_t start = i;
+    char quote = '\0';
+    for (; (i < length) && (line[i] != '\0'); i++) {
+      char c = line[i];
+      if (quote == '\'') {
+        // nothing is escaped between single quotes
+        if (c == '\'') {
+          quote = '\0';
+        }
+      } else if (c == '\\') {
+        if (i + 1 < length) {
+          i++; // i.e. skip the escaped character
+        }
+      } else if (quote == '"') {
+        if (c == '"') {
+          quote = '\0';
+        }
+      } else if ((c == '"') || (c == '\'')) {
+        quote = c;
+      } else if (isSpace(c)) {
+        break;
+      }
+    }
+
+    if (quote != '\0') {
+      return DOCOPT_ERROR_UNTERMINATED_QUOTE;
+    }
+    slices[*count].offset = start;
+    slices[*count].length = i - start;
+    (*count)++;
+  }
+}
+
+uint8_t Docopt_unescape(char const *text, uint8_t length, char *out) {
+  uint8_t outLength = 0;
+  char quote = '\0';
+
+  for (uint8_t i = 0; i < length; i++) {
+    char c = text[i];
+    if (quote == '\'') {
+      if (c == '\'') {
+        quote = '\0';
+        continue;
+      }
+    } else if ((c == '\\') && (i + 1 < length)) {
+      c = text[++i];
+    } else if (quote == '"') {
+      if (c == '"') {
+        quote = '\0';
+        continue;
+      }
+    } else if ((c == '"') || (c == '\'')) {
+      quote = c;
+      continue;
+    }
+    out[outLength++] = c;
+  }
+  return outLength;
+}
+
+uint16_t Docopt_crc16(uint16_t crc, uint8_t const *data, uint8_t length) {
+  for (uint8_t i = 0; i < length; i++) {
+    crc ^= (uint16_t)(data[i] << 8);
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000u) ? (uint16_t)((crc << 1) ^ 0x1021u)
+                            : (uint16_t)(crc << 1);
+    }
+  }
+  return crc;
+}
@@ -0,0 +1,98 @@
+#ifndef DOCOPT_TOKENIZE_H
+#define DOCOPT_TOKENIZE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* What all of the modules share, as none of it depends on the usage lines */
+
+enum DocoptError {
+    DOCOPT_NO_ERROR = 0,
+    DOCOPT_ERROR_TOO_MANY_TOKENS,
+    DOCOPT_ERROR_TOO_MANY_NAMED,
+    DOCOPT_ERROR_TOO_MANY_POSITIONAL,
+    DOCOPT_ERROR_MISSING_POSITIONAL,
+    DOCOPT_ERROR_UNEXPECTED_POSITIONAL,
+    DOCOPT_ERROR_UNKNOWN_OPTION,
+    DOCOPT_ERROR_OPTION_VALUE,
+    DOCOPT_ERROR_MISSING_OPTION,
+    DOCOPT_ERROR_EXCLUSIVE_OPTIONS,
+    DOCOPT_ERROR_BAD_VALUE,
+    DOCOPT_ERROR_TOO_LONG,
+    DOCOPT_ERROR_UNTERMINATED_QUOTE,
+    DOCOPT_ERROR_BAD_FRAME,
+    /* i.e. how many there are (e.g. for a table of them) */
+    DOCOPT_ERROR_COUNT
+};
+
+/* A token of a command line, as a slice of the line's own bytes */
+typedef struct {
+   uint8_t offset;
+   uint8_t length;
+} DocoptSlice;
+
+/* Where text (e.g. the help) is written to, a chunk at a time */
+typedef void (*DocoptWriteFunc)(char const *text, uint8_t length);
+
+/* A token to be parsed, wherever its bytes are (which aren't changed) */
+typedef struct {
+   char const *text;
+   uint8_t length;
+} DocoptToken;
+
+/**
+ * Splits a line into slices of its tokens, which are separated by spaces
+ * (or tabs). Quotes ("a b" or 'a b') and backslashes (a\ b) keep spaces in a
+ * token, and stay in its slice.
+ *
+ * NB: This doesn't change (or keep) the line, so the same bytes can be
+ *     parsed again, logged or kept as history.
+ */
+enum DocoptError Docopt_tokenize(char const *line, uint8_t length,
+                                 DocoptSlice *slices, uint8_t maxSlices,
+                                 uint8_t *count);
+
+/**
+ * Copies the text of a token to out without its quotes and backslashes, and
+ * returns its new length (which is never more than the old one).
+ */
+uint8_t Docopt_unescape(char const *text, uint8_t length, char *out);
+
+/*
+ * A binary frame (e.g. for <module>_processFrame()) follows the magic byte:
+ *
+ *   length, command ID (2), arguments..., CRC (2)
+ *
+ * where the length is the number of bytes of the command ID and arguments,
+ * the CRC is that of the length, command ID and arguments, and each
+ * argument is:
+ *
+ *   kind, option ID (2, only for an option), length, value...
+ *
+ * The numbers of two bytes are little endian. A reply (e.g. from the shell)
+ * is a frame of a status (DOCOPT_BINARY_DONE or DOCOPT_BINARY_FAILED) and
+ * the text of the error, in place of the command ID and arguments.
+ */
+enum {
+   DOCOPT_BINARY_MAGIC = 0x10,
+   /* The longest frame (after the magic byte) */
+   DOCOPT_BINARY_FRAME_MAX = 255,
+   /* The kind of an argument, or'd with DOCOPT_BINARY_INT if its value is an
+    * int32_t (which is given to the handler as decimal text) */
+   DOCOPT_BINARY_POSITIONAL = 0x00,
+   DOCOPT_BINARY_OPTION = 0x01,
+   DOCOPT_BINARY_INT = 0x80,
+   /* The status of a reply */
+   DOCOPT_BINARY_DONE = 0x00,
+   DOCOPT_BINARY_FAILED = 0x01,
+};
+
+#define DOCOPT_CRC16_INIT 0xFFFFu
+
+/**
+ * Adds the bytes to the CRC-16 (CCITT, i.e. the polynomial 0x1021) of a
+ * frame so far, which starts at DOCOPT_CRC16_INIT.
+ */
+uint16_t Docopt_crc16(uint16_t crc, uint8_t const *data, uint8_t length);
+
+#endif // DOCOPT_TOKENIZE_H
@@ -5,51 +5,151 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <poll.h>    //poll, POLLIN
 #include <termios.h> //termios, TCSANOW, ECHO, ICANON
 #include <unistd.h>  //STDIN_FILENO
 
 #include "cli_shell.h"
 
 #if 0
-static char const *handleCommand(uint8_t argc, char **argv) {
-  if (argc == 1 && strcmp("hi", argv[0]) == 0) {
+static char const *handleCommand(char const *line, DocoptSlice const *slices,
+                                 uint8_t count) {
+  if (count == 1 && slices[0].length == 2 &&
+      strncmp("hi", &line[slices[0].offset], 2) == 0) {
     printf("HI yourself\r\n");
     return NULL;
   }
 
   static char errbuf[50];
-  if (argc > 0) {
-    snprintf(errbuf, sizeof(errbuf), "no cmd: %d, [0]=%s", argc, argv[0]);
+  if (count > 0) {
+    snprintf(errbuf, sizeof(errbuf), "no cmd: %d, [0]=%.*s", count,
+             slices[0].length, &line[slices[0].offset]);
   } else {
-    snprintf(errbuf, sizeof(errbuf), "no cmd: %d", argc);
+    snprintf(errbuf, sizeof(errbuf), "no cmd: %d", count);
   }
   return errbuf;
 }
 
 static char const *getPrompt() { return "PROMPT>"; }
+
+// No streaming, so the line is tokenized once it is entered
+static CliShell_lineChangedFunc lineChanged = NULL;
+static CliShell_lineEnteredFunc lineEntered = NULL;
+static CliShell_completeFunc complete = NULL;
+static CliShell_listCompletionsFunc listCompletions = NULL;
+
+// No resumable commands, so each command is done when it returns
+static char const *pending = NULL;
+static CliShell_resumeFunc resume = NULL;
+static CliShell_cancelFunc cancel = NULL;
+
+// No binary frames, so the magic byte is only a character
+static CliShell_processFrameFunc processFrame = NULL;
 #else
 #include "navalfate_autogen.h"
 
-static char const *handleCommand(uint8_t argc, char **argv) {
- return Navalfate_processCommand(argc, argv);
+// The shell's own context, i.e. another shell (e.g. on another UART) would
+// have another one
+static NavalfateContext context;
+
+static char const *handleCommand(char const *line, DocoptSlice const *slices,
+                                 uint8_t count) {
+ return Navalfate_processLineCtx(&context, line, slices, count);
+}
+
+// The command words are matched as they are typed
+static NavalfateStream stream;
+
+static void lineChanged(char const *line, uint8_t length, uint8_t changedFrom) {
+ Navalfate_streamUpdate(&stream, line, length, changedFrom);
+}
+static char const *lineEntered(char const *line, uint8_t length) {
+ return Navalfate_streamEndCtx(&context, &stream, line, length);
 }
 static char const *getPrompt() { 
  return Navalfate_getPrompt();
 }
+
+// TAB finishes the command words (and options)
+static uint8_t complete(char const *line, uint8_t length, char *completion,
+                        uint8_t size) {
+ return Navalfate_complete(line, length, completion, size);
+}
+static void writeText(char const *text, uint8_t length) {
+ fwrite(text, 1, length, stdout);
+}
+static void listCompletions(char const *line, uint8_t length) {
+ Navalfate_listCompletions(line, length, writeText);
+}
+
+// A long command (e.g. "mine sweep") runs a slice at a time
+static char const *const pending = NAVALFATE_PENDING;
+
+static char const *resume(void) {
+ return Navalfate_resumeCtx(&context);
+}
+static char const *cancel(void) {
+ return Navalfate_cancelCtx(&context);
+}
+
+// A host can send a command as a binary frame instead (e.g. from
+// navalfate_binary.py)
+static char const *processFrame(uint8_t const *frame, uint8_t length) {
+ return Navalfate_processFrameCtx(&context, frame, length);
+}
 #endif
 
 static bool isProbablyAKillSignal(char c) {
-  // This is just as a bit of a get out of gaol free for the program
-  return c < 7;
+  // This is just as a bit of a get out of gaol free for the program (but not
+  // Ctrl-C, which cancels the command that is running)
+  return (c < 7) && (c != 0x03);
+}
+
+static void lineResult(size_t lineNumber, char const *err) {
+  if (err) {
+    fprintf(stderr, "line %zu: Error: %s\n", lineNumber, err);
+  }
+}
+
+static int runScript(struct cliShell *cli, char const *path,
+                     bool stopOnError) {
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL) {
+    fprintf(stderr, "unable to open %s\n", path);
+    return EXIT_FAILURE;
+  }
+
+  // i.e. the whole script is one transfer, as it would be from a host
+  static char script[1 << 16];
+  size_t length = fread(script, 1, sizeof(script), fp);
+  fclose(fp);
+
+  size_t failures =
+      CliShell_executeBuffer(cli, script, length, stopOnError, lineResult);
+  return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-int main(void) {
+int main(int argc, char *argv[]) {
   struct cliShell *cli = CliShell_alloc(getPrompt, handleCommand, stdout);
   if (cli == NULL) {
     printf("unable to alloc cli");
     exit(0);
   }
+  CliShell_setResumable(cli, pending, resume, cancel);
 
+  // e.g. ./example [--stop-on-error] commands.txt
+  if (argc > 1) {
+    bool stopOnError = (strcmp(argv[1], "--stop-on-error") == 0);
+    if (stopOnError && (argc < 3)) {
+      fprintf(stderr, "usage: %s [--stop-on-error] <script>\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+    return runScript(cli, argv[argc - 1], stopOnError);
+  }
+
+  CliShell_setStreaming(cli, lineChanged, lineEntered);
+  CliShell_setCompletion(cli, complete, listCompletions);
+  CliShell_setBinary(cli, processFrame);
   CliShell_start(cli);
 
   // Create a UART / serialport esque environment in the terminal
@@ -63,16 +163,34 @@ int main(void) {
 
   // This part would be implemented in a microcontroller with a task / interrupt
   // handler etc ... NB: in this implementation the "stdout" is similar to the
-  // TXBUF (depending on your chip) and the "getchar()" here is similar to the
-  // bytes coming in on the RXBUF
-  char c;
-  do {
-    c = getchar();
+  // TXBUF (depending on your chip) and the "read()" here is similar to the
+  // bytes coming in on the RXBUF. While a command is running it gets its next
+  // slice whenever no byte is waiting, and otherwise this waits for one.
+  while (true) {
+    struct pollfd input = {.fd = STDIN_FILENO, .events = POLLIN};
+    if (poll(&input, 1, 0) <= 0) {
+      if (CliShell_poll(cli)) {
+        continue;
+      }
+      poll(&input, 1, -1);
+    }
+
+    char c;
+    if (read(STDIN_FILENO, &c, 1) != 1) {
+      // i.e. the end of the input, so let the command (and anything typed
+      // after it) finish first
+      while (CliShell_poll(cli)) {
+      }
+      break;
+    }
+    if (!CliShell_inFrame(cli) && isProbablyAKillSignal(c)) {
+      break;
+    }
     enum CliShell_Error err = CliShell_handleChar(cli, c);
     if (err != CLI_SHELL_SUCCESS) {
       printf("Had error while handling char:%c [%x]\r\n", c, c);
     }
-  } while (!isProbablyAKillSignal(c));
+  }
 
   tcsetattr(STDIN_FILENO, TCSANOW, &oldTermios);
 }
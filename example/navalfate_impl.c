@@ -4,10 +4,12 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 enum {
   MAX_SHIPS = 5,
   MAX_NAME_LEN = 50,
+  MINE_SECTORS = 5,
 };
 
 static uint8_t shipCount = 0;
@@ -15,16 +17,57 @@ static char shipNames[MAX_SHIPS][MAX_NAME_LEN] = {0};
 
 static void printShip(int idx) { printf("[%u]: %s\r\n", idx, shipNames[idx]); }
 
-char const *Navalfate_handle_Help(DocoptArgs *args) {
-  return Navalfate_getHelpText();
+static void writeText(char const *text, uint8_t length) {
+  fwrite(text, 1, length, stdout);
 }
 
-char const *Navalfate_handle_Error(DocoptArgs *args) {
-  printf("Hmm...we had an error\r\n");
+#if NAVALFATE_INSTRUMENT
+// On the host the nanoseconds stand in for the cycles (on a target this
+// would read e.g. the DWT cycle counter)
+NavalfateCycles Navalfate_timestamp(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (NavalfateCycles)(now.tv_sec * 1000000000u + now.tv_nsec);
+}
+#endif
+
+char const *Navalfate_handle_Help(NavalfateArgs *args) {
+  Navalfate_writeCommandHelp(args, writeText);
   return NULL;
 }
 
-char const *Navalfate_handle_Ships(DocoptArgs *args) {
+char const *Navalfate_handle_Error(NavalfateArgs *args) {
+  switch (args->error) {
+  case DOCOPT_ERROR_TOO_MANY_TOKENS:
+    return "too many arguments";
+  case DOCOPT_ERROR_TOO_MANY_POSITIONAL:
+    return "too many arguments";
+  case DOCOPT_ERROR_MISSING_POSITIONAL:
+    return "too few arguments";
+  case DOCOPT_ERROR_UNEXPECTED_POSITIONAL:
+    return "too many arguments";
+  case DOCOPT_ERROR_UNKNOWN_OPTION:
+    return "unsupported option";
+  case DOCOPT_ERROR_OPTION_VALUE:
+    return "option value missing or not expected";
+  case DOCOPT_ERROR_MISSING_OPTION:
+    return "required option missing";
+  case DOCOPT_ERROR_EXCLUSIVE_OPTIONS:
+    return "options can't be used together";
+  case DOCOPT_ERROR_BAD_VALUE:
+    return "bad argument value";
+  case DOCOPT_ERROR_TOO_LONG:
+    return "arguments too long";
+  case DOCOPT_ERROR_UNTERMINATED_QUOTE:
+    return "unterminated quote";
+  case DOCOPT_ERROR_BAD_FRAME:
+    return "bad frame";
+  default:
+    return "bad command";
+  }
+}
+
+char const *Navalfate_handle_Ships(NavalfateArgs *args) {
   if (args->help) {
     printf("Print the list of ships\r\n");
     return NULL;
@@ -37,24 +80,12 @@ char const *Navalfate_handle_Ships(DocoptArgs *args) {
   return NULL;
 }
 
-char const *Navalfate_handle_ShipCreate(DocoptArgs *args) {
+char const *Navalfate_handle_ShipCreate(NavalfateArgs *args) {
   if (args->help) {
     printf("Create a ship\r\n");
     return NULL;
   }
 
-  if (args->namedCount > 0) {
-    return "no named args used";
-  }
-
-  if (args->posCount > 1) {
-    return "too many arguments";
-  }
-
-  if (args->posCount == 0) {
-    return "too few arguments";
-  }
-
   if (shipCount == MAX_SHIPS) {
     return "too many ships already";
   }
@@ -71,9 +102,11 @@ char const *Navalfate_handle_ShipCreate(DocoptArgs *args) {
   return NULL;
 }
 
-char const *Navalfate_handle_ShipMove(DocoptArgs *args) {
-  if (args->posCount != 3) {
-    return "incorrect args count";
+char const *Navalfate_handle_ShipMove(NavalfateArgs *args) {
+  if (args->help) {
+    // i.e. just its usage line and options
+    Navalfate_writeCommandHelp(args, writeText);
+    return NULL;
   }
 
   int idx = -1;
@@ -89,32 +122,49 @@ char const *Navalfate_handle_ShipMove(DocoptArgs *args) {
 
   printf("Moving ship %s to %s, %s", args->posValue[0], args->posValue[1],
          args->posValue[2]);
-  if (args->namedCount == 0) {
+  if (args->optionValue[NAVALFATE_OPTION_SPEED] == NULL) {
     printf(" at unknown speed\r\n");
-  } else if (strcmp("speed", args->namedLabel[0]) == 0) {
-    printf(" at %s knots\r\n", args->namedValue[0]);
   } else {
-    printf(" with an unsupported option list:\r\n");
-    for (int i = 0; i < args->namedCount; i++) {
-      printf("  > %s = %s\r\n", args->namedLabel[i], args->namedValue[i]);
-    }
+    printf(" at %s knots\r\n", args->optionValue[NAVALFATE_OPTION_SPEED]);
   }
 
   return NULL;
 }
-char const *Navalfate_handle_ShipShoot(DocoptArgs *args) {
+char const *Navalfate_handle_ShipShoot(NavalfateArgs *args) {
 
   return "Not implemented";
 }
 
-char const *Navalfate_handle_MineSet(DocoptArgs *args) {
+char const *Navalfate_handle_MineSet(NavalfateArgs *args) {
   return "Not implemented";
 }
 
-char const *Navalfate_handle_MineRemove(DocoptArgs *args) {
+char const *Navalfate_handle_MineRemove(NavalfateArgs *args) {
   return "Not implemented";
 }
 
-char const *Navalfate_handle_MineSweep(DocoptArgs *args) {
-  return "Not implemented";
+// Sweeps a sector each time it is called (which takes a while), so the shell
+// carries on between the sectors, and Ctrl-C can stop it
+char const *Navalfate_handle_MineSweep(NavalfateArgs *args) {
+  if (args->help) {
+    printf("Sweep the mines, a sector at a time\r\n");
+    return NULL;
+  }
+  if (args->cancel) {
+    printf("Stopped after %u of %u sectors\r\n", (unsigned)args->resume,
+           MINE_SECTORS);
+    return NULL;
+  }
+
+  struct timespec sweep = {.tv_sec = 0, .tv_nsec = 200000000};
+  nanosleep(&sweep, NULL);
+  args->resume++;
+  printf("Swept sector %u of %u\r\n", (unsigned)args->resume, MINE_SECTORS);
+  return (args->resume < MINE_SECTORS) ? NAVALFATE_PENDING : NULL;
+}
+
+char const *Navalfate_handle_Stats(NavalfateArgs *args) {
+  // i.e. the stats of the shell's own context
+  Navalfate_writeStats(Navalfate_contextOf(args), writeText);
+  return NULL;
 }
@@ -0,0 +1,218 @@
+#include "fuzz_autogen.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+  LINE_LENGTH_MAX = 255,
+  INPUTS_MAX = 4096,
+};
+
+static void discardText(char const *text, uint8_t length) {
+  (void)text;
+  (void)length;
+}
+
+/**
+ * Runs the input through each of the ways into the parser: as a line (through
+ * the tokenizer, so with quotes and escapes), as a line typed a character at
+ * a time (through the stream, and the completion after each character), and
+ * split at each space or NUL into the arguments of a command.
+ *
+ * NB: Each copy of the input is on the heap and only as long as it is, so
+ *     that the sanitizer catches anything read past its end.
+ */
+int LLVMFuzzerTestOneInput(uint8_t const *data, size_t size) {
+  uint8_t length = (size > LINE_LENGTH_MAX) ? LINE_LENGTH_MAX : (uint8_t)size;
+  char *line = malloc(length + 1);
+  memcpy(line, data, length);
+
+  DocoptSlice slices[FUZZ_ARGS_TOKENS_MAX];
+  uint8_t count;
+  if (Docopt_tokenize(line, length, slices, FUZZ_ARGS_TOKENS_MAX, &count) ==
+      DOCOPT_NO_ERROR) {
+    Fuzz_processLine(line, slices, count);
+  }
+
+  FuzzStream stream;
+  Fuzz_streamReset(&stream);
+  for (uint8_t typed = 1; typed <= length; typed++) {
+    char completion[16];
+    Fuzz_streamUpdate(&stream, line, typed, typed - 1);
+    Fuzz_complete(line, typed, completion, sizeof(completion));
+    Fuzz_listCompletions(line, typed, discardText);
+  }
+  Fuzz_streamEnd(&stream, line, length);
+
+  // one more than the most arguments, so that too many is tried too
+  char *argv[FUZZ_ARGS_TOKENS_MAX + 1];
+  uint8_t argc = 0;
+  line[length] = '\0';
+  for (char *arg = line; (arg < &line[length]) && (argc < sizeof(argv) / sizeof(argv[0]));) {
+    size_t argLength = strcspn(arg, " ");
+    arg[argLength] = '\0';
+    if (argLength > 0) {
+      argv[argc++] = arg;
+    }
+    arg += argLength + 1;
+  }
+  Fuzz_processCommand(argc, argv);
+
+  free(line);
+  return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+// A fuzzer of its own, for when libFuzzer isn't there: each input given
+// (e.g. by afl-fuzz with "@@"), then as many runs of them changed at random
+
+static uint8_t inputs[INPUTS_MAX][LINE_LENGTH_MAX];
+static size_t inputLengths[INPUTS_MAX];
+static unsigned inputCount = 0;
+
+static uint8_t current[LINE_LENGTH_MAX];
+static size_t currentLength = 0;
+
+/**
+ * Saves the input that was being run when the sanitizer stops the run.
+ */
+static void saveCrash(void) {
+  FILE *f = fopen("crash-input", "wb");
+  if (f != NULL) {
+    fwrite(current, 1, currentLength, f);
+    fclose(f);
+    fprintf(stderr, "The input is in crash-input\n");
+  }
+}
+
+static void runInput(uint8_t const *data, size_t size) {
+  memcpy(current, data, size);
+  currentLength = size;
+  LLVMFuzzerTestOneInput(current, currentLength);
+}
+
+static void readInput(char const *path) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    perror(path);
+    exit(1);
+  }
+  size_t size = fread(current, 1, sizeof(current), f);
+  fclose(f);
+  runInput(current, size);
+  if (inputCount < INPUTS_MAX) {
+    memcpy(inputs[inputCount], current, size);
+    inputLengths[inputCount++] = size;
+  }
+}
+
+/**
+ * Changes the input a little: flips a bit, puts in or takes out a byte,
+ * or puts in a piece of another input.
+ */
+static size_t mutate(uint8_t *data, size_t size) {
+  size_t at = (size > 0) ? (size_t)rand() % size : 0;
+  switch (rand() % 4) {
+  case 0:
+    if (size > 0) {
+      data[at] ^= (uint8_t)(1 << (rand() % 8));
+    }
+    return size;
+  case 1:
+    if (size < LINE_LENGTH_MAX) {
+      memmove(&data[at + 1], &data[at], size - at);
+      data[at] = (uint8_t)" -=\"'\\?\0"[rand() % 8];
+      return size + 1;
+    }
+    return size;
+  case 2:
+    if (size > 0) {
+      memmove(&data[at], &data[at + 1], size - at - 1);
+      return size - 1;
+    }
+    return size;
+  default: {
+    unsigned other = (unsigned)rand() % inputCount;
+    size_t piece = (size_t)rand() % (inputLengths[other] + 1);
+    if (size + piece > LINE_LENGTH_MAX) {
+      piece = LINE_LENGTH_MAX - size;
+    }
+    memmove(&data[at + piece], &data[at], size - at);
+    memcpy(&data[at], inputs[other], piece);
+    return size + piece;
+  }
+  }
+}
+
+/**
+ * Prints what each line (of the arguments, split at each space) is taken to
+ * be: the name of the handler that was called, or the error.
+ */
+static void runLines(void) {
+  char line[LINE_LENGTH_MAX + 2];
+  while (fgets(line, sizeof(line), stdin) != NULL) {
+    char *argv[FUZZ_ARGS_TOKENS_MAX + 1];
+    uint8_t argc = 0;
+    for (char *arg = strtok(line, " \n");
+         (arg != NULL) && (argc < sizeof(argv) / sizeof(argv[0]));
+         arg = strtok(NULL, " \n")) {
+      argv[argc++] = arg;
+    }
+    char const *result = Fuzz_processCommand(argc, argv);
+    printf("%s\n", (result != NULL) ? result : "(null)");
+  }
+}
+
+static void writeText(char const *text, uint8_t length) {
+  fwrite(text, 1, length, stdout);
+}
+
+extern void __sanitizer_set_death_callback(void (*callback)(void));
+
+int main(int argc, char **argv) {
+  unsigned long runs = 0;
+  int first = 1;
+  if ((argc > 1) && (strcmp(argv[1], "-l") == 0)) {
+    runLines();
+    return 0;
+  }
+  if ((argc > 1) && (strcmp(argv[1], "-h") == 0)) {
+    Fuzz_writeHelp(writeText);
+    return 0;
+  }
+  if ((argc > 2) && (strcmp(argv[1], "-n") == 0)) {
+    runs = strtoul(argv[2], NULL, 10);
+    first = 3;
+  }
+  if (first >= argc) {
+    fprintf(stderr, "usage: %s [-n runs] inputs...\n"
+                    "       %s -l < lines.txt\n"
+                    "       %s -h\n", argv[0], argv[0], argv[0]);
+    return 1;
+  }
+
+  __sanitizer_set_death_callback(saveCrash);
+  for (int i = first; i < argc; i++) {
+    readInput(argv[i]);
+  }
+  srand(1);
+  for (unsigned long run = 0; (run < runs) && (inputCount > 0); run++) {
+    unsigned input = (unsigned)rand() % inputCount;
+    memcpy(current, inputs[input], inputLengths[input]);
+    currentLength = inputLengths[input];
+    for (int changes = 1 + rand() % 4; changes > 0; changes--) {
+      currentLength = mutate(current, currentLength);
+    }
+    LLVMFuzzerTestOneInput(current, currentLength);
+    if ((inputCount < INPUTS_MAX) && (rand() % 16 == 0)) {
+      // i.e. keep some of them, to be changed further
+      memcpy(inputs[inputCount], current, currentLength);
+      inputLengths[inputCount++] = currentLength;
+    }
+  }
+  printf("%d inputs, and %lu runs of them changed\n", argc - first, runs);
+  return 0;
+}
+#endif
@@ -0,0 +1,382 @@
+"""Checks the generated parser against docopt itself
+
+Usage:
+  harness.py handlers <header> <output_c>
+  harness.py corpus <docopt_file> <output_dir> [--lines=<n>] [--seed=<n>]
+  harness.py compare <docopt_file> <lines_file> <driver>
+  harness.py tokens <docopt_file> <lines_file> [--seed=<n>]
+  harness.py matchers <lines_file> <drivers>...
+  harness.py help <docopt_file> <driver>
+
+Options:
+  --lines=<n>  How many lines to make from each usage line [default: 50]
+  --seed=<n>   Seed for the random choices, so that each run makes the same
+               lines [default: 1]
+
+handlers  writes a handler for each command of the generated header, that
+          returns its own name (so that the driver can print which one was
+          called), or "Help" if help was asked for. The error handler
+          returns "Error" and the number of the error
+corpus    writes lines made from the usage lines: each usage line with its
+          choices made at random, and each of those changed a little (e.g. a
+          positional argument dropped or added, an unknown option, a command
+          word misspelt, or one part of a group like "[(<x> <y>)]" left
+          out). lines.txt has one per line, and seeds/ has each in a
+          file of its own (for the fuzzer)
+compare   runs each line through docopt.docopt() and the driver, and fails if
+          they don't agree on which command the line is (or that it is an
+          error, or asks for help). The lines on which the generated parser
+          is known to differ are only counted.
+tokens    writes lines with each command word and option of the usage lines
+          in turn replaced by every one of them, and by near misses of it:
+          its prefixes, extensions and case variants
+matchers  runs the lines through each of the drivers (built with different
+          matchers), and fails if they don't all take each line to be the
+          same command (or the same error)
+help      checks that the help text the driver writes is (byte for byte) that
+          of the docopt file, which may have non-ASCII characters in it
+
+Known differences:
+  an option given more than once, that the usage line doesn't repeat, is
+  taken by the generated parser (with the last value), and rejected by docopt
+  a positional argument before the first command word is taken by the
+  generated parser (which doesn't keep their order), and rejected by docopt
+"""
+
+import os
+import random
+import re
+import subprocess
+import sys
+import docopt
+
+# The values given to positional arguments and options (none of which look
+# like an option, or a command word)
+VALUES = ["7", "42", "Titanic", "x1", "3.5"]
+
+REJECTED = "(rejected)"
+
+
+def write_handlers(header, output_c):
+    with open(header, 'r') as f:
+        # i.e. each handler, and its module's args struct
+        names = re.findall(r'^char const \*(\w+_handle_(\w+))\((\w+) \*args',
+                           f.read(), re.MULTILINE)
+    with open(output_c, 'w') as f:
+        f.write('#include "{}"\n\n#include <stdio.h>\n'.format(
+            os.path.basename(header)))
+        for function, command, args in names:
+            if command == "Error":
+                f.write('\nchar const *{}({} *args) {{\n'
+                        '  static char name[16];\n'
+                        '  snprintf(name, sizeof(name), "Error %d", '
+                        '(int)args->error);\n'
+                        '  return name;\n}}\n'.format(function, args))
+                continue
+            f.write('\nchar const *{}({} *args) {{\n'
+                    '  return args->help ? "Help" : "{}";\n}}\n'.format(
+                        function, args, command))
+
+
+def usage_patterns(doc):
+    """The pattern of each usage line with command words, and the options"""
+    options = docopt.parse_defaults(doc)
+    usage = docopt.printable_usage(doc)
+    pattern = docopt.parse_pattern(docopt.formal_usage(usage), options)
+    lines = [
+        p for p in pattern.children[0].children
+        if any(isinstance(c, docopt.Command) for c in p.children)
+    ]
+    return lines, options
+
+
+def option_tokens(option, rng):
+    """The tokens of an option, in one of the ways it can be given"""
+    names = ([(option.long, True)] if option.long else []) + (
+        [(option.short, False)] if option.short else [])
+    name, long = rng.choice(names)
+    if not option.argcount:
+        return [name]
+    value = rng.choice(VALUES)
+    if long:
+        return rng.choice([[name + "=" + value], [name, value]])
+    return rng.choice([[name + value], [name, value]])
+
+
+def groups(node):
+    """
+    The groups of more than one part that a line can leave out, e.g.
+    "[<x> <y>]", or the "(<x> <y>)" of "[(<x> <y>)]" or of "(<a> | <x> <y>)"
+    """
+    found = []
+    if not hasattr(node, 'children'):
+        return found
+    if isinstance(node, docopt.Optional) and len(node.children) > 1:
+        found.append(node)
+    if isinstance(node, (docopt.Optional, docopt.Either)):
+        found += [c for c in node.children
+                  if isinstance(c, docopt.Required) and len(c.children) > 1]
+    for child in node.children:
+        found += groups(child)
+    return found
+
+
+def contains(node, part):
+    return node is part or any(
+        contains(c, part) for c in getattr(node, 'children', []))
+
+
+def instance(node, options, rng, drop=None):
+    """
+    The tokens of a line that matches the pattern, or (with drop) of one that
+    has the group drop but only some of its parts
+    """
+    if node is drop:
+        parts = list(node.children)
+        del parts[rng.randrange(len(parts))]
+        return [t for c in parts for t in instance(c, options, rng)]
+    if drop is not None and isinstance(node, (docopt.Optional,
+                                              docopt.Either)):
+        # i.e. the group is always there, less one of its parts
+        child = next((c for c in node.children if contains(c, drop)), None)
+        if child is not None:
+            if isinstance(node, docopt.Either):
+                return instance(child, options, rng, drop)
+            tokens = []
+            for c in node.children:
+                if c is child:
+                    tokens += instance(c, options, rng, drop)
+                elif rng.random() < 0.5:
+                    tokens += instance(c, options, rng)
+            return tokens
+    if isinstance(node, docopt.Command):
+        return [node.name]
+    if isinstance(node, docopt.Argument):
+        return [rng.choice(VALUES)]
+    if isinstance(node, docopt.Option):
+        return option_tokens(node, rng)
+    if isinstance(node, docopt.OptionsShortcut):
+        return [t for o in options if rng.random() < 0.3
+                for t in option_tokens(o, rng)]
+    if isinstance(node, docopt.Either):
+        return instance(rng.choice(node.children), options, rng)
+    if isinstance(node, docopt.Optional):
+        return [t for c in node.children if rng.random() < 0.5
+                for t in instance(c, options, rng)]
+    if isinstance(node, docopt.OneOrMore):
+        return [t for i in range(rng.randint(1, 3))
+                for t in instance(node.children[0], options, rng,
+                                  drop if i == 0 else None)]
+    return [t for c in node.children
+            for t in instance(c, options, rng, drop)]
+
+
+def mutate(tokens, options, rng):
+    """The line changed a little, which may (or may not) still be valid"""
+    tokens = list(tokens)
+    kind = rng.randrange(6)
+    if kind == 0 and tokens:
+        del tokens[rng.randrange(len(tokens))]
+    elif kind == 1:
+        tokens.insert(rng.randint(0, len(tokens)), rng.choice(VALUES))
+    elif kind == 2:
+        tokens.append("--bogus")
+    elif kind == 3 and options:
+        tokens += option_tokens(rng.choice(options), rng)
+    elif kind == 4 and tokens:
+        i = rng.randrange(len(tokens))
+        tokens[i] += "x"
+    elif kind == 5 and tokens:
+        tokens.append(tokens[-1])
+    return tokens
+
+
+def write_corpus(doc, output_dir, count, rng):
+    lines, options = usage_patterns(doc)
+    corpus = []
+    for line in lines:
+        for _ in range(count):
+            tokens = instance(line, options, rng)
+            corpus.append(tokens)
+            corpus.append(mutate(tokens, options, rng))
+            parts = groups(line)
+            if parts:
+                corpus.append(instance(line, options, rng,
+                                       drop=rng.choice(parts)))
+
+    seeds = os.path.join(output_dir, "seeds")
+    os.makedirs(seeds, exist_ok=True)
+    with open(os.path.join(output_dir, "lines.txt"), "w") as f:
+        for idx, tokens in enumerate(corpus):
+            f.write(" ".join(tokens) + "\n")
+            with open(os.path.join(seeds, "%04d" % idx), "w") as seed:
+                seed.write(" ".join(tokens))
+
+
+def near_misses(word):
+    """The word's prefixes, extensions and case variants"""
+    misses = [word[:n] for n in range(1, len(word))]
+    misses += [word + c for c in ("x", "_", "-", word[-1])] + [word + word]
+    misses += [word.upper(), word.capitalize(), word.swapcase()]
+    return [m for m in dict.fromkeys(misses) if m != word]
+
+
+def write_tokens(doc, lines_file, rng):
+    lines, options = usage_patterns(doc)
+    words = sorted({c.name for l in lines for c in l.flat(docopt.Command)})
+    names = sorted({n for l in lines for o in l.flat(docopt.Option)
+                    for n in (o.long, o.short) if n} |
+                   {n for o in options for n in (o.long, o.short) if n})
+    corpus = [[t] for t in words + names]
+    for line in lines:
+        tokens = instance(line, options, rng)
+        corpus.append(tokens)
+        for idx, token in enumerate(tokens):
+            name, equals, value = token.partition("=")
+            if name in words:
+                others = words + near_misses(name)
+            elif name in names:
+                others = names + near_misses(name)
+            else:
+                continue
+            corpus += [tokens[:idx] + [other + equals + value] +
+                       tokens[idx + 1:] for other in others if other != name]
+        corpus += [tokens + [t] for name in names
+                   for t in [name] + near_misses(name)]
+
+    with open(lines_file, "w") as f:
+        for tokens in corpus:
+            f.write(" ".join(tokens) + "\n")
+
+
+def compare_matchers(lines_file, drivers):
+    with open(lines_file, 'r') as f:
+        lines = f.read().splitlines()
+    results = [
+        subprocess.run([driver, "-l"], input="".join(l + "\n" for l in lines),
+                       capture_output=True, text=True,
+                       check=True).stdout.splitlines() for driver in drivers
+    ]
+
+    mismatches = 0
+    for idx, line in enumerate(lines):
+        taken = [r[idx] for r in results]
+        if len(set(taken)) > 1:
+            mismatches += 1
+            print("{!r}: {}".format(line, ", ".join(
+                "{} {}".format(d, t) for d, t in zip(drivers, taken))))
+    print("{} lines, {} mismatches".format(len(lines), mismatches))
+    return mismatches == 0
+
+
+def handler_names(lines):
+    """The name of each command's handler, by its command words"""
+    names = {}
+    for line in lines:
+        parts = [c.name for c in line.children
+                 if isinstance(c, docopt.Command)]
+        names[frozenset(parts)] = "".join(
+            p.capitalize() for p in parts).replace("_", "")
+    return names
+
+
+def docopt_decision(doc, names, tokens):
+    """The handler docopt takes the line to be for (or that it rejects it)"""
+    # i.e. docopt (with help=True) gives the help whenever it is asked for,
+    # and the generated parser passes it to the command's handler
+    if "-h" in tokens or "--help" in tokens:
+        return "Help"
+    try:
+        result = docopt.docopt(doc, argv=tokens, help=False)
+    except SystemExit:
+        return REJECTED
+    words = frozenset(k for k, v in result.items()
+                      if v is True and not k.startswith("-"))
+    if words in names:
+        return names[words]
+    return "Help" if result.get("--help") else REJECTED
+
+
+def known_difference(tokens, line):
+    """If the generated parser is known to take the line differently"""
+    repeats = {o.long or o.short for o in line.flat(docopt.Option)
+               if any(o in r.flat(docopt.Option)
+                      for r in line.flat(docopt.OneOrMore))}
+    given = [t.split("=")[0] for t in tokens if t.startswith("-")]
+    if any(given.count(o) > 1 and o not in repeats for o in set(given)):
+        return True
+    first = line.children[0] if line.children else None
+    return (isinstance(first, docopt.Command) and bool(tokens) and
+            not tokens[0].startswith("-") and tokens[0] != first.name)
+
+
+def compare(doc, lines_file, driver):
+    lines, _ = usage_patterns(doc)
+    names = handler_names(lines)
+    handlers = set(names.values()) | {"Help"}
+
+    with open(lines_file, 'r') as f:
+        corpus = [line.split() for line in f]
+    run = subprocess.run([driver, "-l"],
+                         input="".join(" ".join(t) + "\n" for t in corpus),
+                         capture_output=True, text=True, check=True)
+
+    mismatches = 0
+    known = 0
+    for tokens, result in zip(corpus, run.stdout.splitlines()):
+        expected = docopt_decision(doc, names, tokens)
+        got = result if result in handlers else REJECTED
+        if got == expected:
+            continue
+        line = next((l for l in lines if frozenset(
+            c.name for c in l.flat(docopt.Command)) in names and names[
+                frozenset(c.name for c in l.flat(docopt.Command))] == got),
+                    None)
+        if line is not None and known_difference(tokens, line):
+            known += 1
+            continue
+        mismatches += 1
+        print("{!r}: docopt {}, generated {} ({})".format(
+            " ".join(tokens), expected, got, result))
+    print("{} lines, {} mismatches ({} known differences)".format(
+        len(corpus), mismatches, known))
+    return mismatches == 0
+
+
+def check_help(doc, driver):
+    expected = doc.replace("\n", "\r\n").encode("utf-8")
+    run = subprocess.run([driver, "-h"], capture_output=True, check=True)
+    if run.stdout != expected:
+        print("help text: expected {!r}, got {!r}".format(expected,
+                                                         run.stdout))
+        return False
+    print("help text: {} bytes".format(len(expected)))
+    return True
+
+
+def main():
+    args = docopt.docopt(__doc__)
+    if args['handlers']:
+        write_handlers(args['<header>'], args['<output_c>'])
+        return
+    if args['matchers']:
+        if not compare_matchers(args['<lines_file>'], args['<drivers>']):
+            sys.exit(1)
+        return
+    with open(args['<docopt_file>'], 'r', encoding='utf-8') as f:
+        doc = f.read()
+    if args['corpus']:
+        write_corpus(doc, args['<output_dir>'], int(args['--lines']),
+                     random.Random(int(args['--seed'])))
+    elif args['tokens']:
+        write_tokens(doc, args['<lines_file>'],
+                     random.Random(int(args['--seed'])))
+    elif args['help']:
+        if not check_help(doc, args['<driver>']):
+            sys.exit(1)
+    elif not compare(doc, args['<lines_file>'], args['<driver>']):
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
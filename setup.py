@@ -15,7 +15,7 @@ setup(
     keywords=["docopt", "microcontroller", "cli"],
     packages=find_packages(where="src"),
     package_dir={"": "src"},
-    package_data={'docopt_uc': ['templates/*.c', 'templates/*.h']},
+    package_data={'docopt_uc': ['templates/*.c', 'templates/*.h', 'templates/*.py']},
     zip_safe=False,
     classifiers=[
         "Development Status :: 3 - Alpha",
@@ -2,12 +2,16 @@
 
 Usage:
   docopt-uc <module_name> <docopt_file> [options]
+  docopt-uc --merge=<shell_name> (<module_name> <docopt_file>)... [options]
+  docopt-uc --batch=<batch_file> [options]
   docopt-uc (-h | --help)
   docopt-uc --version
 
 Example, try:
   docopt-uc NavalFate navalfate.docopt --short=">"
   docopt-uc NavalFate navalfate.docopt --template_h=OUR_TEMPLATE_automatic.h --template_c=OUR_TEMPLATE_automatic.c --template_prefix=OUR_TEMPLATE
+  docopt-uc --merge=Shell Motor motor.docopt Power power.docopt
+  docopt-uc --batch=clis.txt --depfile
 
 Options:
   -h --help     Show this screen.
@@ -16,21 +20,159 @@ Options:
   --template_c=<filename>  Name of .c templates [default: CLI_TEMPLATE_autogen.c].
                            NB: this is shipped with the package
   --template_prefix=<str>  Part of the template filename to replace [default: CLI_TEMPLATE].
+  --merge=<shell_name>     Generate one parser (named this) for the commands
+                           of all of the modules, which matches the command
+                           words of them all at once and calls the handlers
+                           of each module. Each module's handlers are in a
+                           header of its own (e.g. "motor_autogen.h")
+  --batch=<batch_file>     Generate each of the modules listed in this file,
+                           one a line as "<module_name> <docopt_file>
+                           [options]" (or "--merge=..."), with the options
+                           given here as well, unless the line has its own
+                           (e.g. "--output_dir=motor"). Blank lines and "#"
+                           comments are skipped. They are generated in the
+                           one process (so the templates are read once), a
+                           few at a time, and the files are only written once
+                           they have all been generated
+  --jobs=<n>               How many modules --batch generates at a time, or
+                           0 for one per CPU [default: 0]
+  --depfile                Also write a make (or ninja) depfile of the
+                           module's files, named after it (e.g.
+                           "navalfate.d"), which lists the docopt file(s) and
+                           templates they are generated from [default: False]
   --output_dir=<str>       Where to write files [default: ./].
   --short=<prompt>         Replace the prompt with this instead (i.e. replace
                            the "docopt_uc.py" with this string)
-  --no-docopt-args-h       Prevent the output of the "docopt_args.h" file [default: False]
+  --template_args_h=<filename>  Name of the template of the module's args
+                           header (e.g. "navalfate_args.h", which has the
+                           NavalfateArgs struct sized to fit the module)
+                           [default: DOCOPT_ARGS_TEMPLATE.h].
+                           NB: this is shipped with the package
+  --template_tokenize_h=<filename>  Name of the template of the
+                           "docopt_tokenize.h" that all of the modules share
+                           (the errors, the tokenizer and the binary frames)
+                           [default: DOCOPT_TOKENIZE_TEMPLATE.h].
+                           NB: this is shipped with the package
+  --template_tokenize_c=<filename>  Name of the template of the tokenizer
+                           [default: DOCOPT_TOKENIZE_TEMPLATE.c].
+                           NB: this is shipped with the package
+  --no-docopt-tokenize     Prevent the output of the "docopt_tokenize.h" (and
+                           "docopt_tokenize.c") files, e.g. when another
+                           module already writes them, as they are the same
+                           for every module [default: False]
   --multithreaded          When using the default template, this will place the
-                           DocoptArgs struct on the stack (instead of having
-                           only one. Activate this if you need multiple
-                           instances of the same CLI. [default: False]
+                           context (i.e. the <Module>Args struct) of the calls
+                           that don't take one on the stack (instead of
+                           having only one. Activate this if you need
+                           multiple instances of the same CLI, or pass each
+                           its own context to the "...Ctx" calls.
+                           [default: False]
+  --no-validation          Do not check the arguments of each command against
+                           its usage line before calling the handler
+                           [default: False]
+  --typed-args             Give each command handler its own struct of
+                           arguments, converted to C types from the usage
+                           line (e.g. "<x:int>") and option defaults, instead
+                           of the <Module>Args struct [default: False]
+  --matcher=<strategy>     How the generated parser recognises command tokens,
+                           either "trie" (a character trie walked once per
+                           argument) or "strcmp" (compare against every
+                           token name) [default: trie].
+  --dispatch=<strategy>    How the generated code finds the handler for a
+                           command, either "switch" (a switch on the opcode)
+                           or "table" (a binary search of a const table of
+                           opcodes and handlers). CLIs with more than 64
+                           command words always use "table" [default: switch].
+  --streaming              Also generate a "stream" that matches the command
+                           words of a line while it is typed, so there is
+                           less to do once it is entered [default: False]
+  --completion             Also generate _complete() and _listCompletions(),
+                           which give the command words (or "--" options)
+                           that could finish the last word of a line, e.g.
+                           for the TAB key [default: False]
+  --abbreviations          Accept any unique prefix of a command word or long
+                           option (e.g. "sh cr" for "ship create"), which
+                           costs nothing with the "trie" matcher. NB: a
+                           positional argument that is a prefix of a word is
+                           then taken to be the word [default: False]
+  --tokens-max=<n>         The most tokens a line can have when the usage
+                           lines don't limit it (i.e. with a repeated
+                           "<argument>..." or --no-validation), otherwise it
+                           is worked out from them [default: 16]
+  --text-max=<n>           The room (in bytes) for the values of a line's
+                           arguments, each with a NUL. The usage lines don't
+                           say how long a value can be, but the values of a
+                           line can't take more than the line, so the longest
+                           line your shell takes (plus one) is always enough.
+                           If no usage line takes a value there is no room
+                           for them [default: 64]
+  --rom=<attribute>        Place the strings (the help text, and the names
+                           for the "strcmp" matcher) and all of the constant
+                           tables (the tries, rules, commands...) in program
+                           memory with this attribute (e.g. "PROGMEM", or
+                           "__attribute__((section(\".cli\")))")
+  --rom-read=<prefix>      How the generated code reads them from there, as
+                           the prefix of its byte, word and dword macros (e.g.
+                           "pgm_read" for pgm_read_byte, pgm_read_word and
+                           pgm_read_dword)
+  --rom-include=<header>   A header that the generated code needs for these
+                           (e.g. "avr/pgmspace.h")
+  --compress-help          Keep the help text compressed (its common
+                           substrings, e.g. the prompt and command words, are
+                           replaced by a byte each), to be decoded a few
+                           characters at a time as it is written out. There
+                           is then no _getHelpText(), only _writeHelp()
+                           [default: False]
+  --instrument             Also add a "stats" command, and (when compiled
+                           with <MODULE>_INSTRUMENT defined) time the parsing,
+                           the dispatch and each handler with a timestamp
+                           function of your own, and count the errors (in
+                           the context of each call), to be written out by
+                           _writeStats() [default: False]
+  --binary                 Also generate _processFrame(), which takes a
+                           command as a binary frame (its ID, its arguments,
+                           and a CRC) rather than a line, and a python
+                           module (e.g. "navalfate_binary.py") that encodes
+                           them, for a host that sends many commands
+                           [default: False]
+  --template_py=<filename>  Name of the template of that python module
+                           [default: CLI_TEMPLATE_binary.py].
+                           NB: this is shipped with the package
+  --resumable              Let a handler do a long job a slice at a time, by
+                           returning <MODULE>_PENDING (keeping where it got
+                           to in args->resume) to be called again by
+                           _resumeCtx(), until it is done or cancelled by
+                           _cancelCtx() [default: False]
+  --report                 Print the size of each buffer (in RAM) and table
+                           (in flash) the generated code will have, for a
+                           target with 32-bit pointers [default: False]
+  --measure                Compile the generated code, and print the size of
+                           each of its symbols (from nm) and the most stack
+                           _processCommand() (and _processLine()) can use,
+                           from gcc's -fcallgraph-info [default: False]
+  --cc=<compiler>          The gcc to compile it with for --measure, e.g.
+                           "arm-none-eabi-gcc" (its nm and size are those
+                           with the same prefix). By default that one, if it
+                           is on the path, otherwise gcc
+  --cflags=<flags>         The flags to compile it with for --measure
+                           [default: -Os]
+  --budget=<limits>        Measure it (as --measure), and fail if it takes
+                           more than any of these, e.g.
+                           "text=4096,rodata=2048,bss=512,stack=256"
 
 """
 
 import sys
 import os.path
-import docopt
+import concurrent.futures
+import functools
+import hashlib
+import re
+import shlex
 import shutil
+import subprocess
+import tempfile
+import docopt
 from jinja2 import Template, environment
 import pkg_resources
 
@@ -51,31 +193,951 @@ def escape_c_keywords(s):
     return s
 
 
+def c_char(c):
+    if c in ("'", "\\"):
+        return "'\\" + c + "'"
+    return "'" + c + "'"
+
+
+def c_uint_type(max_value):
+    for bits in (8, 16, 32):
+        if max_value < (1 << bits):
+            return "uint{}_t".format(bits)
+    return "uint64_t"
+
+
+def macro_params(count):
+    """Parameter names for a macro, i.e. a, b, c ... z, a1, b1 ..."""
+    letters = "abcdefghijklmnopqrstuvwxyz"
+    return [
+        letters[i % 26] + (str(i // 26) if i >= 26 else "")
+        for i in range(count)
+    ]
+
+
+def c_int_type(max_value):
+    for bits in (8, 16, 32):
+        if max_value < (1 << (bits - 1)):
+            return "int{}_t".format(bits)
+    return "int64_t"
+
+
 environment.DEFAULT_FILTERS['escape_c_keywords'] = escape_c_keywords
+environment.DEFAULT_FILTERS['c_char'] = c_char
+environment.DEFAULT_FILTERS['c_uint_type'] = c_uint_type
+environment.DEFAULT_FILTERS['c_int_type'] = c_int_type
+environment.DEFAULT_FILTERS['macro_params'] = macro_params
+
+OPCODE_WORD_BITS = 32
+
+# the room for arguments when the usage lines don't limit them (i.e. when
+# they aren't validated)
+NAMED_ARGS_MAX = 7
+POSITIONAL_ARGS_MAX = 7
+# i.e. textUsed is a uint8_t
+TEXT_LIMIT = 255
+# i.e. the widest bitmap of tokens
+TOKENS_LIMIT = 64
+# for the report, i.e. a 32-bit target
+POINTER_SIZE = 4
+
+MATCHERS = ("trie", "strcmp")
+DISPATCHERS = ("switch", "table")
+
+
+def positional_range(node):
+    """
+    The (minimum, maximum) number of positional arguments that a pattern
+    accepts, where the maximum is None if it is unbounded (i.e. "...").
+    """
+    if isinstance(node, docopt.Command):
+        return 0, 0
+    if isinstance(node, docopt.Argument):
+        return 1, 1
+    if not hasattr(node, 'children'):
+        return 0, 0  # i.e. an option
+
+    ranges = [positional_range(c) for c in node.children]
+    unbounded = any(high is None for _, high in ranges)
+    if isinstance(node, docopt.Either):
+        low = min(low for low, _ in ranges)
+        high = None if unbounded else max(high for _, high in ranges)
+        return low, high
+
+    low = sum(low for low, _ in ranges)
+    high = None if unbounded else sum(high for _, high in ranges)
+    if isinstance(node, docopt.Optional):
+        low = 0
+    if isinstance(node, docopt.OneOrMore) and high:
+        high = None
+    return low, high
+
+
+def positional_counts(node, most):
+    """
+    The numbers of positional arguments that a pattern accepts (as docopt
+    takes them, where each part of "[<a> <b>]" can be left out on its own),
+    with any number over most counted as most.
+    """
+    if isinstance(node, docopt.Command):
+        return {0}
+    if isinstance(node, docopt.Argument):
+        return {1}
+    if not hasattr(node, 'children'):
+        return {0}  # i.e. an option
+
+    children = [positional_counts(c, most) for c in node.children]
+    if isinstance(node, docopt.Either):
+        return set().union(*children)
+    if isinstance(node, docopt.Optional):
+        children = [counts | {0} for counts in children]
+    counts = {0}
+    for child in children:
+        counts = {min(a + b, most) for a in counts for b in child}
+    if isinstance(node, docopt.OneOrMore):
+        once = counts
+        while True:
+            more = counts | {min(a + b, most) for a in counts for b in once}
+            if more == counts:
+                break
+            counts = more
+    return counts
+
+
+def repeats_options(pattern):
+    """If an option can be given any number of times (e.g. "-v...")"""
+    return any(
+        r.flat(docopt.Option, docopt.OptionsShortcut)
+        for r in pattern.flat(docopt.OneOrMore))
+
+
+def c_type_size(ctype):
+    """The size of a C type on the target (for the report)"""
+    if ctype.endswith("*"):
+        return POINTER_SIZE
+    match = re.match(r'^u?int(\d+)_t$', ctype)
+    if match:
+        return int(match.group(1)) // 8
+    return {"bool": 1, "char": 1, "enum": 4}[ctype]
+
+
+def c_rom_read(ctype):
+    """
+    How the generated code reads a value of a C type from a table in ROM (i.e.
+    what goes before its address), e.g. "(int8_t)ROM_BYTE"
+    """
+    read = {1: "ROM_BYTE", 2: "ROM_WORD", 4: "ROM_DWORD"}[c_type_size(ctype)]
+    if ctype == "bool" or ctype.startswith("uint"):
+        return read
+    return "({}){}".format(ctype, read)
+
+
+environment.DEFAULT_FILTERS['rom_read'] = c_rom_read
+
+
+@functools.lru_cache(maxsize=None)
+def docopt_errors():
+    """
+    The enumerators of DocoptError in docopt_tokenize.h (i.e. DOCOPT_NO_ERROR and
+    each error, up to DOCOPT_ERROR_COUNT), read from its template so that the
+    tables of them can't miss one that is added
+    """
+    with open(template_path("DOCOPT_TOKENIZE_TEMPLATE.h"), 'r') as f:
+        enum = re.search(r'enum DocoptError \{(.*?)\}', f.read(), re.S)
+    names = re.findall(r'^\s*(DOCOPT_\w+)', enum.group(1), re.M)
+    return names[:names.index("DOCOPT_ERROR_COUNT")]
+
+
+def error_name(error):
+    """The name of a DocoptError for people, e.g. "too many tokens" """
+    return error.replace("DOCOPT_ERROR_", "").replace("DOCOPT_", "").replace(
+        "_", " ").lower()
+
+# The command that --instrument adds to the usage lines
+STATS_COMMAND = "stats"
+
+
+def crc16(data, crc=0xFFFF):
+    """The CRC-16 (CCITT) of the bytes, as Docopt_crc16() works it out"""
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+        crc &= 0xFFFF
+    return crc
+
+
+def binary_id(name):
+    """
+    The ID of a command (e.g. "ship new") or option (e.g. "--speed") in a
+    binary frame, which only changes if its name does
+    """
+    return crc16(name.encode())
+
+
+def c_struct_size(fields):
+    """
+    The size of a C struct with these (size, alignment) members, including
+    its padding
+    """
+    offset = 0
+    alignment = 1
+    for size, align in fields:
+        offset = (offset + align - 1) // align * align + size
+        alignment = max(alignment, align)
+    return (offset + alignment - 1) // alignment * alignment
+
+
+def c_array(ctype, count=1):
+    """The (size, alignment) of a member that is an array of a C type"""
+    size = c_type_size(ctype)
+    return size * count, size
+
+
+# placeholder annotations, e.g. "<x:int>", and the C type each gives a field
+TYPE_ANNOTATIONS = {
+    "int": "int32_t",
+    "uint": "uint32_t",
+    "str": "char const *",
+}
+CONVERTED_TYPES = ("int32_t", "uint32_t")
+ANNOTATION_RE = re.compile(r'<([^<>\s:]+):({})>'.format("|".join(TYPE_ANNOTATIONS)))
+
+
+def add_usage_line(doc, words):
+    """The doc with a usage line for the words after its last one"""
+    usage = docopt.printable_usage(doc)
+    last = usage.split('\n')[-1]
+    indent = last[:len(last) - len(last.lstrip())]
+    prompt = usage.split()[1]
+    end = doc.index(usage) + len(usage)
+    return doc[:end] + '\n' + indent + prompt + ' ' + words + doc[end:]
+
+
+def c_include_name(name):
+    """The name of a module's files, e.g. "navalfate" (of navalfate_autogen.h)"""
+    return name.lower().strip()
+
+
+def c_module_prefix(name):
+    """The prefix of a module's C names, e.g. "Navalfate" (of Navalfate_...)"""
+    return "".join([p.capitalize() for p in c_include_name(name).split('_')])
+
+
+def strip_annotations(text):
+    return ANNOTATION_RE.sub(r'<\1>', text)
+
+
+def c_identifier(name):
+    return escape_c_keywords(re.sub(r'[^A-Za-z0-9_]', '_', name))
+
+
+def option_name(option):
+    """
+    The name of an option as the parser sees it (i.e. without the "--"), or
+    its letter if it only has a short form
+    """
+    return option.long[2:] if option.long else option.short[1:]
+
+
+def is_help(option):
+    return option.long == "--help" or (option.long is None
+                                       and option.short == "-h")
+
+
+class Module:
+    """One of the CLIs that --merge puts into the shell"""
+
+    def __init__(self, name, doc):
+        self.name = name
+        self.doc = doc
+
+    @property
+    def include_name(self):
+        return c_include_name(self.name)
+
+    @property
+    def module_prefix(self):
+        return c_module_prefix(self.name)
+
+    @property
+    def usage_lines(self):
+        return docopt.printable_usage(self.doc).split('\n')[1:]
+
+    @property
+    def option_names(self):
+        """The names of the options the module has or uses"""
+        options = docopt.parse_defaults(self.doc)
+        usage = docopt.printable_usage(self.doc)
+        pattern = docopt.parse_pattern(docopt.formal_usage(usage), options)
+        return set(
+            option_name(o)
+            for o in options + pattern.flat(docopt.Option)
+            if not is_help(o))
+
+
+def option_blocks(doc):
+    """
+    The text of each option in the "Options:" sections, as docopt splits them
+    (i.e. the line of the option, and the lines of its description after it)
+    """
+    blocks = []
+    for section in docopt.parse_section('options:', doc):
+        _, _, section = section.partition(':')
+        split = re.split(r'\n[ \t]*(-\S+?)', '\n' + section)[1:]
+        blocks += [name + text for name, text in zip(split[::2], split[1::2])
+                   if name.startswith('-')]
+    return blocks
+
+
+def merge_docs(prompt, modules):
+    """
+    The doc of a shell with the commands of all of the modules, i.e. each of
+    their usage lines (with the shell's prompt) and each of their options
+    """
+    lines = []
+    for module in modules:
+        for line in module.usage_lines:
+            words = line.split(None, 1)
+            lines.append("  " + " ".join([prompt] + words[1:]))
+
+    blocks = []
+    seen = {}
+    for module in modules:
+        for block in option_blocks(module.doc):
+            option = docopt.Option.parse(block)
+            names = [n for n in (option.short, option.long) if n]
+            same = [seen[n] for n in names if n in seen]
+            if not same:
+                for name in names:
+                    seen[name] = (option, module)
+                blocks.append(block)
+                continue
+            other, owner = same[0]
+            if (other.short, other.long, other.argcount,
+                    other.value) != (option.short, option.long,
+                                     option.argcount, option.value):
+                raise docopt.DocoptExit(
+                    'The option {} of {} is not the same as that of {}'.format(
+                        names[0], module.name, owner.name))
+
+    doc = "Usage:\n" + "\n".join(lines) + "\n"
+    if blocks:
+        doc += "\nOptions:\n" + "\n".join("  " + b for b in blocks) + "\n"
+    return doc
+
+
+class NamedOption:
+    """An option that has a slot of its own in the args struct"""
+
+    def __init__(self, name, short=None, has_value=False, long=True):
+        self.name = name
+        self.short = short  # i.e. the letter, if it has a short form
+        self.has_value = has_value
+        self.long = long  # i.e. if it has a "--name" form
 
 
 class Command:
-    def __init__(self, parts, docopt_text=None):
+    def __init__(self, parts, docopt_text=None, pattern=None, all_options=(),
+                 module=None):
         self.parts = parts
         self.docopt_text = docopt_text
+        self.pattern = pattern
+        self.all_options = all_options
+        self.module = module  # i.e. with --merge, the Module it is from
 
     @property
     def function_name(self):
         return "".join(p.capitalize() for p in self.parts).replace("_", "")
 
+    @property
+    def positional_range(self):
+        if self.pattern is None:
+            return 0, None
+        return positional_range(self.pattern)
+
+    def positional_counts(self, most):
+        """
+        The numbers of positional arguments the command accepts, up to most
+        (as there is never room for more), as a mask with a bit for each
+        """
+        if self.pattern is None:
+            return (1 << (most + 1)) - 1
+        counts = positional_counts(self.pattern, most + 1)
+        return sum(1 << n for n in counts if n <= most)
+
+    def tokens_max(self, options):
+        """
+        The most tokens a line of this command can have (its words, positional
+        arguments, options and their values, and asking for help), or None if
+        there is no limit (i.e. "...")
+        """
+        _, positional = self.positional_range
+        if positional is None or repeats_options(self.pattern):
+            return None
+        has_value = {o.name: o.has_value for o in options}
+        named = sum(2 if has_value.get(n) else 1 for n, _ in self.options)
+        return len(self.parts) + positional + named + 1
+
+    def _walk_options(self, node, optional, found):
+        if isinstance(node, docopt.OptionsShortcut):
+            for option in self.all_options:
+                found.append((option, True))
+        elif isinstance(node, docopt.Option):
+            found.append((node, optional))
+        elif hasattr(node, 'children'):
+            optional = optional or isinstance(
+                node, (docopt.Optional, docopt.Either))
+            for child in node.children:
+                self._walk_options(child, optional, found)
+
+    @property
+    def options(self):
+        """The named options the command accepts, as (name, required) pairs"""
+        found = []
+        if self.pattern is not None:
+            self._walk_options(self.pattern, False, found)
+        options = []
+        for option, optional in found:
+            name = option_name(option)
+            if not is_help(option) and name not in (o for o, _ in options):
+                options.append((name, not optional))
+        return options
+
+    def fields(self, doc):
+        """The members of the command's typed arguments struct"""
+        if self.pattern is None:
+            return []
+        fields = []
+        seen = set()
+        arguments = [
+            a for a in self.pattern.flat(docopt.Argument)
+            if not isinstance(a, docopt.Command)
+        ]
+        repeated = set(
+            a.name for r in self.pattern.flat(docopt.OneOrMore)
+            for a in r.flat(docopt.Argument))
+        after_repeated = False
+        for position, argument in enumerate(arguments):
+            if argument.name in seen:
+                continue
+            seen.add(argument.name)
+            match = ANNOTATION_RE.match(argument.name)
+            if match:
+                name, ctype = match.group(1), TYPE_ANNOTATIONS[match.group(2)]
+            else:
+                name, ctype = argument.name.strip("<>"), "char const *"
+            field = Field(c_identifier(name), ctype, position=position,
+                          argument=argument.name)
+            if after_repeated:
+                # i.e. counted back from the end of the positional arguments
+                field.from_end = len(arguments) - position
+            if argument.name in repeated:
+                after_repeated = True
+                # NB: repeated arguments stay as strings, and take all of the
+                #     positional arguments not used by the ones after them
+                field.ctype = "char *const *"
+                field.repeated = True
+                field.trailing = len(arguments) - position - 1
+            fields.append(field)
+
+        for name, _ in self.options:
+            option = next(
+                (o for o in self.all_options if option_name(o) == name), None)
+            if option is None or option.argcount == 0:
+                fields.append(Field(c_identifier(name), "bool", option=name))
+                continue
+            default = option.value
+            match = re.search(r'--{}[= ]<[^<>\s:]+:(\w+)>'.format(re.escape(name)), doc)
+            numeric = default is not None and re.match(r'^-?[0-9]+$', default)
+            if match and match.group(1) in TYPE_ANNOTATIONS:
+                ctype = TYPE_ANNOTATIONS[match.group(1)]
+                if ctype != "char const *" and default is not None and not numeric:
+                    raise docopt.DocoptExit(
+                        'The default of --{} is not a number: {}'.format(
+                            name, default))
+            elif numeric:
+                ctype = "int32_t"
+            else:
+                ctype = "char const *"
+            if numeric and ctype != "char const *":
+                # i.e. in decimal, as a value that is typed is (and not as C
+                # would take "010")
+                default = str(int(default))
+            fields.append(
+                Field(c_identifier(name), ctype, option=name, default=default))
+
+        # i.e. two arguments (e.g. "<speed>" and "--speed") can't be the same
+        #      member of the struct
+        members = {}
+        for field in fields:
+            names = [field.name] + ([field.name + "Count"]
+                                    if field.repeated else [])
+            for member in names:
+                if member in members:
+                    raise docopt.DocoptExit(
+                        'Both {} and {} of "{}" would be the member {} of its '
+                        'typed arguments'.format(members[member].argument,
+                                                 field.argument,
+                                                 " ".join(self.parts), member))
+                members[member] = field
+        return fields
+
+    @property
+    def exclusive_options(self):
+        """
+        The groups of options that can't be used together (e.g.
+        "[--moored|--drifting]"), as (names, required) pairs. A required group
+        needs exactly one of its options.
+        """
+        groups = []
+
+        def walk(node, optional):
+            if isinstance(node, docopt.Either) and all(
+                    isinstance(c, docopt.Option) for c in node.children):
+                names = [
+                    option_name(c) for c in node.children if not is_help(c)
+                ]
+                groups.append((names, not optional))
+            elif hasattr(node, 'children'):
+                optional = optional or isinstance(node, docopt.Optional)
+                for child in node.children:
+                    walk(child, optional)
+
+        if self.pattern is not None:
+            walk(self.pattern, False)
+        return groups
+
+
+class Field:
+    """A member of a command's typed arguments struct"""
+
+    def __init__(self, name, ctype, option=None, position=None,
+                 default=None, repeated=False, argument=None):
+        self.name = name
+        self.ctype = ctype
+        self.option = option  # i.e. the option name, for named arguments
+        self.position = position  # i.e. the index in posValue
+        self.default = default
+        self.repeated = repeated
+        self.trailing = 0
+        self.from_end = None
+        if argument is None:
+            argument = ("-" if len(option) == 1 else "--") + option
+        self.argument = argument  # i.e. as it is in the usage line
+
+    @property
+    def present(self):
+        """C expression for if a positional argument was given"""
+        if self.from_end is not None:
+            return "args->posCount >= {}".format(self.from_end)
+        return "args->posCount > {}".format(self.position)
+
+    @property
+    def value(self):
+        """C expression for the string value of a positional argument"""
+        if self.from_end is not None:
+            return "args->posValue[args->posCount - {}]".format(self.from_end)
+        return "args->posValue[{}]".format(self.position)
+
+    @property
+    def initial_value(self):
+        if self.default is not None:
+            if self.ctype == "char const *":
+                return " ".join(c_string_literals(c_bytes(self.default)))
+            return self.default
+        if self.ctype == "bool":
+            return "false"
+        if self.ctype == "char const *":
+            return "NULL"
+        return "0"
+
+
+class CommandRules:
+    def __init__(self, command, positional_counts, allowed_options,
+                 required_options, first_group, group_count):
+        self.command = command
+        self.positional_counts = positional_counts
+        self.allowed_options = allowed_options
+        self.required_options = required_options
+        self.first_group = first_group
+        self.group_count = group_count
+
+
+def c_bytes(text):
+    """
+    The text as the bytes of its UTF-8, one character for each (so that its
+    lengths and offsets are those of the C string)
+    """
+    return text.encode("utf-8").decode("latin-1")
+
+
+def c_string_literals(text):
+    """
+    The text as C string literals (to be concatenated), one for each of its
+    lines. NB: it has to be bytes, one character for each (see c_bytes)
+    """
+    escapes = {"\\": "\\\\", '"': '\\"', "\r": "\\r", "\n": "\\n",
+               "\t": "\\t"}
+    literals = []
+    literal = ""
+    for c in text:
+        if c in escapes:
+            literal += escapes[c]
+        elif " " <= c <= "~":
+            literal += c
+        else:
+            # NB: the literal ends after an octal escape (of at most three
+            #     digits, for a byte), so that a digit after it can't become
+            #     part of it
+            assert ord(c) <= 0xFF
+            literals.append(literal + "\\{:o}".format(ord(c)))
+            literal = ""
+            continue
+        if c == "\n":
+            literals.append(literal)
+            literal = ""
+    if literal or not literals:
+        literals.append(literal)
+    return ['"{}"'.format(l) for l in literals]
+
+
+# i.e. the bytes from HELP_WORD_CODE up are words of the compressed help
+HELP_WORD_CODE = 0x80
+HELP_WORDS_MAX = 0x100 - HELP_WORD_CODE
+HELP_WORD_LENGTH_MAX = 32
+
+
+def compress_lines(lines):
+    """
+    Compresses lines of text by replacing the substrings that save the most
+    bytes with a code (a character from HELP_WORD_CODE up) for each. The
+    codes never span lines, so each line can be decoded on its own.
+
+    Returns the words (the substring of each code) and the lines.
+    """
+    words = []
+    while len(words) < HELP_WORDS_MAX:
+        counts = {}
+        for line in lines:
+            for start in range(len(line)):
+                end = start
+                while (end < len(line) and end - start < HELP_WORD_LENGTH_MAX
+                       and ord(line[end]) < HELP_WORD_CODE):
+                    end += 1
+                    if end - start > 1:
+                        word = line[start:end]
+                        counts[word] = counts.get(word, 0) + 1
+
+        def saved(word, count):
+            # i.e. a byte for each use, and the word itself (with its offset
+            # and length)
+            return count * (len(word) - 1) - (len(word) + 3)
+
+        # NB: the counts above include overlapping uses, so the best few are
+        #     counted again properly
+        candidates = sorted(counts.items(),
+                            key=lambda item: saved(*item),
+                            reverse=True)[:16]
+        best = max(((saved(w, sum(l.count(w) for l in lines)), w)
+                    for w, _ in candidates),
+                   default=(0, None))
+        if best[0] <= 0:
+            break
+        code = chr(HELP_WORD_CODE + len(words))
+        words.append(best[1])
+        lines = [l.replace(best[1], code) for l in lines]
+    return words, lines
+
+
+class StringPool:
+    """
+    All of the strings that the generated code keeps, in one array. The first
+    is the help text (which is NUL terminated), and any other string that is
+    already part of the array (e.g. a command word in a usage line) shares
+    its bytes rather than being added again.
+
+    NB: The text is kept as bytes (see c_bytes), so the offsets are those of
+        the bytes of the array, whatever the strings have in them.
+    """
+
+    def __init__(self, text=None):
+        self.text = c_bytes(text) + "\0" if text is not None else ""
+        self.offsets = {}
+
+    def add(self, string):
+        if string not in self.offsets:
+            data = c_bytes(string)
+            offset = self.text.find(data)
+            if offset < 0:
+                offset = len(self.text)
+                self.text += data
+            self.offsets[string] = offset
+        return self.offsets[string]
+
+    @property
+    def literals(self):
+        # NB: the last NUL is the literal's own
+        return c_string_literals(self.text[:-1] if self.text.endswith("\0")
+                                 else self.text)
+
+
+class TrieNode:
+    def __init__(self):
+        self.children = {}
+        self.token = None
+
+
+class Trie:
+    """
+    A character trie over a list of tokens, flattened into the tables used by
+    the generated matcher.
+
+    Nodes are numbered breadth first, so the edges leaving each node are
+    contiguous (and sorted by character) in `edges`, starting at
+    `first_edge[node]` and ending before `first_edge[node + 1]`. Node 0 is the
+    root and `tokens[node]` is the index of the token ending at that node (or
+    None).
+    """
+
+    def __init__(self, tokens, abbreviations=False):
+        root = TrieNode()
+        for idx, token in enumerate(tokens):
+            node = root
+            for c in token:
+                node = node.children.setdefault(c, TrieNode())
+            node.token = idx
+
+        nodes = [root]
+        self.first_edge = []
+        self.edges = []
+        for node in nodes:  # NB: nodes grows as we go, i.e. breadth first
+            self.first_edge.append(len(self.edges))
+            for c in sorted(node.children):
+                self.edges.append((c, len(nodes)))
+                nodes.append(node.children[c])
+        self.first_edge.append(len(self.edges))
+        self.tokens = [n.token for n in nodes]
+
+        if abbreviations:
+            # i.e. a node that only one token is below matches that token
+            below = [set() for _ in nodes]
+            for idx in reversed(range(len(nodes))):
+                if nodes[idx].token is not None:
+                    below[idx].add(nodes[idx].token)
+                first, end = self.first_edge[idx], self.first_edge[idx + 1]
+                for _, child in self.edges[first:end]:
+                    below[idx] |= below[child]
+                # NB: but not the root, i.e. an empty argument
+                if (idx > 0 and self.tokens[idx] is None
+                        and len(below[idx]) == 1):
+                    self.tokens[idx] = next(iter(below[idx]))
+
 
 class Rendering:
     def __init__(self, module_name, commands, prompt, doc,
-                 multithreaded=False):
+                 multithreaded=False, matcher="trie", dispatch="switch",
+                 validation=True, all_options=(), typed_args=False,
+                 streaming=False, tokens_limit=16, rom=None, rom_read=None,
+                 rom_include=None, compress_help=False, completion=False,
+                 abbreviations=False, instrument=False, modules=(),
+                 resumable=False, binary=False, text_limit=64):
         self.module_name = module_name
         self.commands = commands
         self.prompt = prompt
         self.doc = doc
         self.multithreaded = multithreaded
+        self.matcher = matcher
+        self._dispatch = dispatch
+        self.validation = validation
+        self.all_options = all_options
+        self.typed_args = typed_args
+        self.streaming = streaming
+        self.tokens_limit = tokens_limit
+        self.text_limit = text_limit
+        self.rom = rom
+        self.rom_read = rom_read
+        self.rom_include = rom_include
+        self.compress_help = compress_help
+        self.completion = completion
+        self.abbreviations = abbreviations
+        self.instrument = instrument
+        self.modules = modules
+        self.resumable = resumable
+        self.binary = binary
+        self._strings = None
+        self._compressed_help = None
 
     @property
     def help(self):
-        return self.doc.replace("\n", "\\r\\n\\\n")
+        return strip_annotations(self.doc).replace("\n", "\r\n")
+
+    @property
+    def help_lines(self):
+        """The lines of the help text (each with its line ending)"""
+        return self.help.splitlines(True)
+
+    @property
+    def compressed_help(self):
+        """The (words, lines) of the compressed help text"""
+        if self._compressed_help is None:
+            self._compressed_help = compress_lines(self.help_lines)
+        return self._compressed_help
+
+    @property
+    def help_line_offsets(self):
+        """
+        Where each line of the help text starts (in the Strings, or in the
+        compressed Help), and where the last one ends, in bytes
+        """
+        # NB: the compressed help is all ASCII (and a byte for each word)
+        lines = (self.compressed_help[1] if self.compress_help else
+                 [c_bytes(l) for l in self.help_lines])
+        offsets = [0]
+        for line in lines:
+            offsets.append(offsets[-1] + len(line))
+        return offsets
+
+    def _help_header(self, name):
+        """The line of the help text that starts a section (e.g. "usage:")"""
+        for idx, line in enumerate(self.help_lines):
+            if line.strip().lower().startswith(name):
+                return idx
+        return None
+
+    @property
+    def help_usage_line(self):
+        return self._help_header("usage:")
+
+    @property
+    def help_options_line(self):
+        return self._help_header("options:")
+
+    def command_help_line(self, command):
+        """The line of the help text with the command's usage line"""
+        text = strip_annotations(command.docopt_text or "")
+        lines = self.help_lines
+        for idx in range(self.help_usage_line + 1, len(lines)):
+            # i.e. without the prompt (which --short may have replaced)
+            words = lines[idx].split(None, 1)
+            if not words:
+                break
+            if len(words) > 1 and words[1].strip() == text:
+                return idx
+        return None
+
+    def option_help_lines(self, option):
+        """
+        The lines of the help text that describe the option (from the
+        "Options:" section), as a (first, end) pair, or None
+        """
+        if self.help_options_line is None:
+            return None
+        names = (["--" + option.name] if option.long else []) + (
+            ["-" + option.short] if option.short else [])
+        lines = self.help_lines
+        for first in range(self.help_options_line + 1, len(lines)):
+            text = lines[first].strip()
+            if not text.startswith("-"):
+                continue
+            spec = text.split("  ")[0].replace(",", " ").replace("=", " ")
+            if not set(names) & set(spec.split()):
+                continue
+            # i.e. and the lines the description carries on over
+            end = first + 1
+            while (end < len(lines) and lines[end][:1].isspace()
+                   and lines[end].strip()
+                   and not lines[end].strip().startswith("-")):
+                end += 1
+            return first, end
+        return None
+
+    @property
+    def help_commands(self):
+        """The commands whose usage lines are in the help text"""
+        return [c for c in self.commands
+                if self.command_help_line(c) is not None]
+
+    @property
+    def option_help(self):
+        """The (first, end) lines of each option, or (0, 0) if it has none"""
+        return [self.option_help_lines(o) or (0, 0) for o in self.options]
+
+    def command_help_options(self, command):
+        """The mask of the options of the command that have lines to show"""
+        help = self.option_help
+        slots = [o.name for o in self.options]
+        return self.option_mask(
+            n for n, _ in command.options if help[slots.index(n)][1] > 0)
+
+    @property
+    def help_literals(self):
+        """The compressed help text as C string literals, one for each line"""
+        return [" ".join(c_string_literals(line))
+                for line in self.compressed_help[1]]
+
+    @property
+    def help_word_offsets(self):
+        """Where each word of the compressed help text is in the Strings"""
+        return [self.strings.offsets[word]
+                for word in self.compressed_help[0]]
+
+    @property
+    def strings(self):
+        """
+        The StringPool of the help text (or the words of the compressed help
+        text), and of the names to match
+        """
+        if self._strings is None:
+            names = []
+            if self.compress_help:
+                self._strings = StringPool()
+                names += self.compressed_help[0]
+            else:
+                self._strings = StringPool(self.help)
+            if self.matcher == "strcmp":
+                names += self.tokens + self.option_names
+            # i.e. longest first, so that the shorter ones can share them
+            for name in sorted(names, key=len, reverse=True):
+                self._strings.add(name)
+        return self._strings
+
+    def fields(self, command):
+        return command.fields(self.doc)
+
+    def typed_args_name(self, command):
+        return "{}{}Args".format(self.handler_prefix(command),
+                                 command.function_name)
+
+    def handler_prefix(self, command):
+        """The prefix of the command's handler (i.e. that of its module)"""
+        if command.module is None:
+            return self.module_prefix
+        return command.module.module_prefix
+
+    def commands_of(self, module):
+        """
+        The commands whose handlers are in the module's header (or, for None,
+        in this one)
+        """
+        return [c for c in self.commands if c.module is module]
+
+    def module_options(self, module):
+        """The options of the module, which its header gives names of its own"""
+        names = module.option_names
+        return [o for o in self.options if o.name in names]
+
+    def converts(self, command):
+        """If any of the command's fields need converting from strings"""
+        return any(f.ctype in CONVERTED_TYPES for f in self.fields(command))
+
+    @property
+    def conversions(self):
+        """The C types that need converting from strings"""
+        if not self.typed_args:
+            return set()
+        return set(f.ctype for c in self.commands for f in self.fields(c)
+                   if f.ctype in CONVERTED_TYPES)
 
     @property
     def tokens(self):
@@ -90,46 +1152,662 @@ class Rendering:
                     l.append(part)
         return l
 
+    @property
+    def dispatch(self):
+        # a multi-word opcode can't be switched on
+        return self._dispatch if self.opcode_words == 1 else "table"
+
+    @property
+    def opcode_bits(self):
+        """The number of bits in the opcode (or in each word of it)"""
+        count = len(self.tokens)
+        for bits in (8, 16, 32, 64):
+            if count <= bits:
+                return bits
+        return OPCODE_WORD_BITS
+
+    @property
+    def opcode_words(self):
+        count = len(self.tokens)
+        if count <= 64:
+            return 1
+        return (count + OPCODE_WORD_BITS - 1) // OPCODE_WORD_BITS
+
+    @property
+    def opcode_type(self):
+        return "uint{}_t".format(self.opcode_bits)
+
+    @property
+    def longest_command(self):
+        return max(len(c.parts) for c in self.commands)
+
+    def opcode(self, command):
+        tokens = self.tokens
+        return sum(1 << tokens.index(p) for p in set(command.parts))
+
+    def opcode_word_values(self, command):
+        """The opcode of the command, split into words (least significant first)"""
+        opcode = self.opcode(command)
+        mask = (1 << self.opcode_bits) - 1
+        return [(opcode >> (i * self.opcode_bits)) & mask
+                for i in range(self.opcode_words)]
+
+    @property
+    def token_follows(self):
+        """
+        The words of the opcodes of the commands that each token is part of,
+        i.e. the tokens that can be on a line with it
+        """
+        follows = []
+        for token in self.tokens:
+            mask = 0
+            for command in self.commands:
+                if token in command.parts:
+                    mask |= self.opcode(command)
+            bits = (1 << self.opcode_bits) - 1
+            follows.append([(mask >> (i * self.opcode_bits)) & bits
+                            for i in range(self.opcode_words)])
+        return follows
+
+    @property
+    def completion_max(self):
+        """
+        The most characters a completion can add (i.e. the longest command
+        word or "--" option, and the space or "=" after it)
+        """
+        names = self.tokens + ["--" + n for n in self.option_names]
+        return max(len(n) for n in names) + 1
+
+    @property
+    def commands_by_opcode(self):
+        return sorted(self.commands, key=self.opcode)
+
+    @property
+    def options(self):
+        """
+        The options from the "Options:" section, and any others used by the
+        commands, in the order of their slots in the args struct
+        """
+        options = []
+        for option in self.all_options:
+            if not is_help(option):
+                short = option.short[1:] if option.short else None
+                options.append(
+                    NamedOption(option_name(option), short,
+                                option.argcount > 0, option.long is not None))
+        # options only mentioned in a usage line (i.e. not in "Options:")
+        for command in self.commands:
+            for name, _ in command.options:
+                if name not in (o.name for o in options):
+                    options.append(NamedOption(name))
+        return options
+
+    @property
+    def option_names(self):
+        """The long option names (and "help"), for the generated matcher"""
+        return [o.name for o in self.options if o.long] + ["help"]
+
+    @property
+    def option_values(self):
+        """The C value the matcher gives for each of the option_names"""
+        return [self.option_enum(n) for n in self.option_names[:-1]
+                ] + ["HELP_OPTION"]
+
+    @property
+    def option_trie(self):
+        return Trie(self.option_names, self.abbreviations)
+
+    @property
+    def short_options(self):
+        """The (letter, option index) of each short option"""
+        shorts = [(o.short, i) for i, o in enumerate(self.options) if o.short]
+        if "h" not in (c for c, _ in shorts):
+            shorts.append(("h", None))  # i.e. help
+        return shorts
+
+    def option_enum(self, name, module=None):
+        """
+        The name of the option's slot, e.g. NAVALFATE_OPTION_SPEED (or the
+        module's name for it)
+        """
+        include_name = (module or self).include_name
+        return "{}_OPTION_{}".format(include_name.upper(),
+                                     c_identifier(name).upper())
+
+    @property
+    def binary_commands(self):
+        """The (ID, command) of each command, sorted by ID"""
+        return sorted(((binary_id(" ".join(c.parts)), c)
+                       for c in self.commands),
+                      key=lambda pair: pair[0])
+
+    @property
+    def binary_options(self):
+        """
+        The (ID, name, C value) of each option (and help), sorted by ID, where
+        the name is its long form (or its short form, if it only has that)
+        """
+        options = [("--" + o.name if o.long else "-" + o.short,
+                    self.option_enum(o.name)) for o in self.options]
+        options.append(("--help", "HELP_OPTION"))
+        return sorted(((binary_id(n), n, v) for n, v in options),
+                      key=lambda option: option[0])
+
+    def binary_command_enum(self, command):
+        """The name of the command's ID, e.g. NAVALFATE_COMMAND_SHIP_NEW"""
+        return "{}_COMMAND_{}".format(self.include_name.upper(),
+                                      c_identifier("_".join(command.parts)).upper())
+
+    def binary_option_enum(self, name):
+        """The name of the option's ID, e.g. NAVALFATE_OPTION_ID_SPEED"""
+        return "{}_OPTION_ID_{}".format(self.include_name.upper(),
+                                        c_identifier(name.lstrip("-")).upper())
+
+    def binary_clash(self):
+        """
+        The names of two commands (or options) with the same ID, if there
+        are any, otherwise None
+        """
+        for ids in ([(i, " ".join(c.parts)) for i, c in self.binary_commands],
+                    [(i, n) for i, n, _ in self.binary_options]):
+            for (a, first), (b, second) in zip(ids, ids[1:]):
+                if a == b:
+                    return first, second
+        return None
+
+    def option_index(self, name):
+        return [o.name for o in self.options].index(name)
+
+    def option_mask(self, names):
+        options = [o.name for o in self.options]
+        return sum(1 << options.index(n) for n in names)
+
+    @property
+    def option_mask_type(self):
+        count = len(self.options)
+        for bits in (8, 16, 32):
+            if count <= bits:
+                return "uint{}_t".format(bits)
+        return "uint64_t"
+
+    @property
+    def positional_mask_type(self):
+        """A bit for each number of positional arguments, from none up"""
+        return c_uint_type((1 << (self.positional_max + 1)) - 1)
+
+    def _group_runs(self):
+        """
+        The groups of exclusive options, and the index of the first group of
+        each command. Commands with the same groups share them.
+        """
+        groups = []
+        first = []
+        for command in self.commands:
+            own = [(self.option_mask(n), r)
+                   for n, r in command.exclusive_options]
+            for start in range(len(groups) + 1):
+                if groups[start:start + len(own)] == own:
+                    break
+            first.append(start)
+            groups.extend(own[len(groups) - start:])
+        return groups, first
+
+    @property
+    def exclusive_groups(self):
+        """The (mask, required) of each group of exclusive options"""
+        return self._group_runs()[0]
+
+    @property
+    def rules(self):
+        """The argument rules of each command, in command order"""
+        _, first = self._group_runs()
+        rules = []
+        for idx, command in enumerate(self.commands):
+            rules.append(
+                CommandRules(
+                    command, command.positional_counts(self.positional_max),
+                    self.option_mask(n for n, _ in command.options),
+                    self.option_mask(n for n, r in command.options if r),
+                    first[idx], len(command.exclusive_options)))
+        return rules
+
+    @property
+    def tokens_max(self):
+        """
+        The most tokens that a line of any usage line can have, or the limit
+        given to the generator if they don't have one
+        """
+        if not self.validation:
+            return self.tokens_limit
+        most = 0
+        for command in self.commands:
+            tokens = command.tokens_max(self.options)
+            if tokens is None:
+                tokens = self.tokens_limit
+            most = max(most, tokens)
+        return most
+
+    @property
+    def errors(self):
+        """The (enumerator, name) of each DocoptError, for ErrorNames[]"""
+        return [(e, error_name(e)) for e in docopt_errors()]
+
+    @property
+    def takes_values(self):
+        """If any usage line takes a value (i.e. text to be kept in "text")"""
+        return (not self.validation or self.positional_max > 0
+                or any(o.has_value for o in self.options))
+
+    @property
+    def text_max(self):
+        """
+        The room for the values of a line's arguments, which is --text-max, as
+        the usage lines don't say how long they can be (or none, if none of
+        them takes one)
+        """
+        return self.text_limit if self.takes_values else 1
+
+    @property
+    def token_mask_type(self):
+        """The C type of a bitmap with a bit for each token of a line"""
+        for bits in (8, 16, 32):
+            if self.tokens_max <= bits:
+                return "uint{}_t".format(bits)
+        return "uint64_t"
+
+    @property
+    def positional_max(self):
+        """
+        The most positional arguments that any usage line takes, where a
+        repeated one ("<name>...") can take every token after the command
+        words
+        """
+        if not self.validation:
+            return POSITIONAL_ARGS_MAX
+        most = 0
+        for command in self.commands:
+            _, high = command.positional_range
+            if high is None:
+                high = self.tokens_max - len(command.parts)
+            most = max(most, high)
+        return min(most, self.tokens_max)
+
+    @property
+    def named_max(self):
+        """
+        The room for options that aren't known, which is none if the
+        arguments are validated (as they would be rejected anyway)
+        """
+        return 0 if self.validation else NAMED_ARGS_MAX
+
+    @property
+    def token_trie(self):
+        return Trie(self.tokens, self.abbreviations)
+
+    def _matcher_sizes(self, kind, trie, names, result_type):
+        """The (table, bytes) of the flash tables of a generated matcher"""
+        if self.matcher == "strcmp":
+            # NB: the names themselves are in the Strings
+            return [("{}Names".format(kind), 3 * len(names)),
+                    ("{}Values".format(kind),
+                     c_type_size(result_type) * len(names))]
+        trie_type = c_uint_type(len(trie.tokens))
+        edge = c_struct_size([c_array("char"), c_array(trie_type)])
+        return [("{}TrieFirstEdge".format(kind),
+                 c_type_size(trie_type) * len(trie.first_edge)),
+                ("{}TrieEdges".format(kind), edge * len(trie.edges)),
+                ("{}TrieMatch".format(kind),
+                 c_type_size(result_type) * len(trie.tokens))]
+
+    def size_report(self):
+        """
+        The (memory, name, bytes) of each buffer (in RAM) and table (in
+        flash) of the generated code, with the buffers sized for this CLI
+        """
+        opcode = c_array(self.opcode_type, self.opcode_words)
+        options = max(len(self.options), 1)
+        struct = self.args_type
+        args = [
+            (struct + ".opcode", opcode),
+            (struct + ".optionValue", c_array("char *", options)),
+            (struct + ".namedLabel", c_array("char *", self.named_max)),
+            (struct + ".namedValue", c_array("char *", self.named_max)),
+            (struct + ".posValue", c_array("char *", self.positional_max)),
+            # i.e. from --text-max, rather than from the usage lines
+            (struct + ".text" + (" (--text-max)" if self.takes_values else
+                                 ""), c_array("char", self.text_max)),
+        ]
+        # i.e. the members of the args, in order
+        members = [opcode, c_array("bool"), c_array("enum"), args[1][1]]
+        if self.named_max:
+            members += [c_array("uint8_t"), args[2][1], args[3][1]]
+        members.append(c_array("uint8_t"))
+        if self.positional_max:
+            members.append(args[4][1])
+        members += [c_array("uint8_t"), args[5][1]]
+        if self.resumable:
+            members += [c_array("uint32_t"), c_array("bool")]
+        args_size = c_struct_size(members)
+        token = c_struct_size([c_array("char *"), c_array("uint8_t")])
+        report = [("RAM", name, size) for name, (size, _) in args if size]
+        report.append(("RAM", struct, args_size))
+        report.append(("RAM", "{}Context.argv".format(self.module_prefix),
+                       token * self.tokens_max))
+        context = [(args_size, POINTER_SIZE),
+                   (token * self.tokens_max, POINTER_SIZE)]
+        if self.resumable:
+            context.append(c_array("bool"))
+        report.append(("RAM", "{}Context".format(self.module_prefix),
+                       c_struct_size(context)))
+        if self.instrument:
+            # i.e. only compiled in with <MODULE>_INSTRUMENT (and so not
+            #      counted in the size of the context above)
+            timing = c_struct_size([c_array("uint32_t", 3),
+                                    c_array("uint64_t")])
+            report.append(("RAM", "{}Context.stats".format(self.module_prefix),
+                           c_struct_size([
+                               (timing * (len(self.commands) + 2), 8),
+                               c_array("uint32_t", len(docopt_errors()))
+                           ])))
+        if self.streaming:
+            matched = c_array(c_int_type(len(self.tokens)), self.tokens_max)
+            report.append(("RAM", "{}Stream.slices".format(self.module_prefix),
+                           2 * self.tokens_max))
+            report.append(("RAM",
+                           "{}Stream.matched".format(self.module_prefix),
+                           matched[0]))
+
+        flash = self._matcher_sizes("Token", self.token_trie, self.tokens,
+                                    c_int_type(len(self.tokens)))
+        flash += self._matcher_sizes("Option", self.option_trie,
+                                     self.option_names,
+                                     c_int_type(len(self.options) + 2))
+        if self.options:
+            flash.append(("OptionHasValue", len(self.options)))
+        if self.validation:
+            mask = c_array(self.option_mask_type) if self.options else None
+            rule = [c_array(self.positional_mask_type)]
+            if mask:
+                rule += [mask, mask]
+                if self.exclusive_groups:
+                    rule += [c_array("uint8_t"), c_array("uint8_t")]
+                    flash.append(("ExclusiveGroups",
+                                  c_struct_size([mask, c_array("bool")]) *
+                                  len(self.exclusive_groups)))
+            flash.append(("Rules", c_struct_size(rule) * len(self.commands)))
+        if self.dispatch == "table":
+            flash.append(("Commands", c_struct_size([
+                c_array(self.opcode_type, self.opcode_words),
+                c_array("void *"),
+                c_array(c_uint_type(len(self.commands)))
+            ]) * len(self.commands)))
+        if self.binary:
+            flash.append(("BinaryCommands", c_struct_size([
+                c_array("uint16_t"),
+                c_array(self.opcode_type, self.opcode_words)
+            ]) * len(self.commands)))
+            flash.append(("BinaryOptions", c_struct_size([
+                c_array("uint16_t"),
+                c_array(c_int_type(len(self.options) + 2))
+            ]) * (len(self.options) + 1)))
+        if self.completion:
+            flash.append(("TokenFollows", len(self.tokens) * c_array(
+                self.opcode_type, self.opcode_words)[0]))
+        flash.append(("Strings", len(self.strings.text) + 1))
+        if self.compress_help:
+            flash.append(("Help", self.help_line_offsets[-1] + 1))
+            flash.append(("HelpWords", 3 * len(self.compressed_help[0])))
+        flash.append(("HelpLines", 2 * len(self.help_line_offsets)))
+        if self.help_usage_line is not None:
+            line = c_array(c_uint_type(len(self.help_line_offsets)))
+            help = [c_array(self.opcode_type, self.opcode_words), line]
+            if self.options and self.help_options_line is not None:
+                help.append(c_array(self.option_mask_type))
+                flash.append(("OptionHelpLines",
+                              2 * line[0] * len(self.options)))
+            flash.append(("CommandHelps",
+                          c_struct_size(help) * len(self.help_commands)))
+        report += [("flash", name, size) for name, size in flash]
+        return report
+
     @property
     def include_name(self):
-        return self.module_name.lower().strip()
+        return c_include_name(self.module_name)
 
     @property
     def module_prefix(self):
-        name = self.include_name
-        parts = name.split('_')
-        return "".join([p.capitalize() for p in parts])
+        return c_module_prefix(self.module_name)
 
+    @property
+    def args_type(self):
+        """The struct of a command's arguments, e.g. "NavalfateArgs" """
+        return self.module_prefix + "Args"
 
-def read_template_file_contents(filename):
-    try:
-        with open(filename, 'r') as f:
-            contents = f.read()
-            return Template(contents)
-    except FileNotFoundError as ex:
-        pass
+    @property
+    def args_header(self):
+        """The header of that struct, e.g. "navalfate_args.h" """
+        return self.include_name + "_args.h"
+
+
+def template_path(filename):
+    """The file of a template, which is either the file given or the one of
+    that name shipped with the package"""
+    if os.path.exists(filename):
+        return filename
     # https://stackoverflow.com/questions/6028000/how-to-read-a-static-file-from-inside-a-python-package
     # try as a package resource
     resource_path = '/'.join(('templates', filename))
-    fn = pkg_resources.resource_filename(__name__, resource_path)
-    with open(fn, 'r') as f:
+    return pkg_resources.resource_filename(__name__, resource_path)
+
+
+# NB: each template is only compiled once, e.g. for all of the modules of a
+#     --batch (in each of its processes)
+@functools.lru_cache(maxsize=None)
+def read_template_file_contents(filename):
+    with open(template_path(filename), 'r') as f:
         contents = f.read()
-        return Template(contents)
+        return Template(contents, keep_trailing_newline=True)
 
 
-def main():
-    args = docopt.docopt(__doc__, version='none')
+def write_if_changed(filename, text):
+    """
+    Writes the file, unless it already has this text (so its timestamp, and
+    that of everything built from it, is left as it is). Returns whether it
+    was written.
+    """
+    digest = hashlib.sha256(text.encode()).digest()
+    try:
+        with open(filename, 'r') as f:
+            if hashlib.sha256(f.read().encode()).digest() == digest:
+                return False
+    except (FileNotFoundError, UnicodeDecodeError):
+        pass
+    with open(filename, 'w') as f:
+        f.write(text)
+    return True
+
+
+def depfile_path(path):
+    """A path as make (and ninja) read it in a depfile"""
+    return path.replace("$", "$$").replace("#", "\\#").replace(" ", "\\ ")
+
+
+def depfile_text(targets, sources):
+    """A depfile's rule, that the targets are made from the sources"""
+    lines = [" ".join(depfile_path(t) for t in targets) + ":"]
+    lines.extend(" " + depfile_path(s) for s in sources)
+    return " \\\n".join(lines) + "\n"
+
+
+# What nm's type letter of a symbol says about where it goes
+NM_MEMORIES = {"t": "text", "r": "rodata", "d": "data", "b": "bss"}
+BUDGET_NAMES = ("text", "rodata", "data", "bss", "stack")
+
+
+def parse_budget(text):
+    """The {name: bytes} of a --budget, e.g. "text=4096,stack=256" """
+    budget = {}
+    for limit in text.split(","):
+        name, _, size = limit.partition("=")
+        name = name.strip()
+        if name not in BUDGET_NAMES or not size.strip().isdigit():
+            raise docopt.DocoptExit(
+                'Bad --budget limit "{}" (expected <name>=<bytes>, with a '
+                'name of: {})'.format(limit, ", ".join(BUDGET_NAMES)))
+        budget[name] = int(size)
+    return budget
+
+
+def find_compiler():
+    """The compiler for --measure, when one isn't given"""
+    if shutil.which("arm-none-eabi-gcc"):
+        return "arm-none-eabi-gcc"
+    return "gcc"
+
+
+def read_call_graph(filename, graph):
+    """
+    Adds the functions of a gcc -fcallgraph-info=su file to the graph, as
+    {name: [stack bytes (or None if unknown), callees]}
+    """
+    node_re = re.compile(r'node: \{ title: "([^"]+)" label: "([^"]*)"')
+    edge_re = re.compile(r'edge: \{ sourcename: "([^"]+)" targetname: "([^"]+)"')
+    stack_re = re.compile(r'\\n(\d+) bytes \(([a-z,]+)\)')
+    with open(filename, 'r') as f:
+        for line in f:
+            node = node_re.match(line)
+            edge = edge_re.match(line)
+            if node:
+                stack = stack_re.search(node.group(2))
+                function = graph.setdefault(node.group(1), [None, []])
+                if stack:
+                    function[0] = int(stack.group(1))
+            elif edge:
+                graph.setdefault(edge.group(1), [None, []])[1].append(
+                    edge.group(2))
+
+
+def worst_stack(graph, name, path=()):
+    """
+    The most stack a call of the function can use, and the functions it
+    calls of which that isn't known (e.g. handlers called through a pointer,
+    or the C library). None if it can recurse.
+    """
+    if name in path:
+        return None, set()
+    stack, callees = graph.get(name, [None, []])
+    unknown = set() if stack is not None else {name}
+    deepest = 0
+    for callee in callees:
+        used, missing = worst_stack(graph, callee, path + (name, ))
+        if used is None:
+            return None, set()
+        deepest = max(deepest, used)
+        unknown |= missing
+    return (stack or 0) + deepest, unknown
+
+
+def section_memory(section, rom=None):
+    """
+    Where a section of the object goes (e.g. ".rodata.str1.1" is "rodata"),
+    or None if it doesn't (e.g. ".comment")
+    """
+    for memory in NM_MEMORIES.values():
+        if section == "." + memory or section.startswith("." + memory + "."):
+            return memory
+    # i.e. a --rom section (e.g. PROGMEM's) stays in flash
+    rom_section = re.search(r'section\("([^"]+)"\)', rom or "")
+    if section.startswith(".progmem") or (rom_section and
+                                          section == rom_section.group(1)):
+        return "rodata"
+    return None
+
 
-    with open(args['<docopt_file>'], 'r') as f:
-        args['<docopt_file>'] = f.read()
+def measure(rendering, output_dir, compiler, cflags):
+    """
+    Compiles the generated code, and gives the (memory, name, bytes) of each
+    of its symbols, the total of each memory, and the (function, stack bytes,
+    the functions of which that isn't known) of the calls that parse a line
+    """
+    tools = compiler[:-len("gcc")] if compiler.endswith("gcc") else ""
+    sources = [rendering.include_name + "_autogen.c"]
+    if os.path.exists(os.path.join(output_dir, "docopt_tokenize.c")):
+        sources.append("docopt_tokenize.c")
 
-    template_h_name = args['--template_h']
-    template_c_name = args['--template_c']
+    symbols = []
+    totals = dict.fromkeys(NM_MEMORIES.values(), 0)
+    graph = {}
+    with tempfile.TemporaryDirectory() as build_dir:
+        for source in sources:
+            obj = os.path.join(build_dir, source[:-2] + ".o")
+            subprocess.run([compiler, "-c", "-o", obj, "-I", output_dir,
+                            "-fcallgraph-info=su"] + shlex.split(cflags) +
+                           [os.path.join(output_dir, source)], check=True)
+            read_call_graph(obj[:-2] + ".ci", graph)
 
-    args['template_h_obj'] = read_template_file_contents(args['--template_h'])
-    args['template_c_obj'] = read_template_file_contents(args['--template_c'])
+            nm = subprocess.run([tools + "nm", "-S", "--size-sort", obj],
+                                check=True, capture_output=True, text=True)
+            for line in nm.stdout.splitlines():
+                _, size, kind, name = line.split()
+                if kind.lower() in NM_MEMORIES:
+                    symbols.append((NM_MEMORIES[kind.lower()], name,
+                                    int(size, 16)))
 
-    doc = args['<docopt_file>']
+            sections = subprocess.run([tools + "size", "-A", obj], check=True,
+                                      capture_output=True, text=True)
+            for line in sections.stdout.splitlines():
+                fields = line.split()
+                if len(fields) == 3 and fields[1].isdigit():
+                    memory = section_memory(fields[0], rendering.rom)
+                    if memory is not None:
+                        totals[memory] += int(fields[1])
+
+    symbols.sort(key=lambda s: (list(NM_MEMORIES.values()).index(s[0]),
+                                -s[2], s[1]))
+    stacks = []
+    for call in ("processCommand", "processLine", "streamEnd", "processFrame"):
+        name = "{}_{}".format(rendering.module_prefix, call)
+        if name in graph:
+            stacks.append((name, ) + worst_stack(graph, name))
+    return symbols, totals, stacks
+
+
+def generate(args):
+    """
+    Generates the module of the arguments (i.e. of one run, or of one line of
+    a --batch), and gives its Rendering, the (filename, text) of each of its
+    files, and the files they are generated from, without writing them
+    """
+    docs = []
+    for filename in args['<docopt_file>']:
+        with open(filename, 'r', encoding='utf-8') as f:
+            docs.append(f.read())
+
+    template_h = read_template_file_contents(args['--template_h'])
+    template_c = read_template_file_contents(args['--template_c'])
+    templates = [args['--template_h'], args['--template_c']]
+
+    if args['--merge'] is not None:
+        module_name = args['--merge']
+        modules = [Module(n, d) for n, d in zip(args['<module_name>'], docs)]
+        # NB: their headers would overwrite each other
+        names = [c_include_name(module_name)] + [m.include_name for m in modules]
+        clash = next((n for n in names if names.count(n) > 1), None)
+        if clash is not None:
+            raise docopt.DocoptExit(
+                'More than one module (or the shell) is named "{}"'.format(
+                    clash))
+        doc = merge_docs(c_include_name(module_name), modules)
+        # i.e. the module of each usage line
+        line_modules = [m for m in modules for _ in m.usage_lines]
+    else:
+        module_name = args['<module_name>'][0]
+        modules = []
+        doc = docs[0]
+        line_modules = []
+
+    if args['--instrument']:
+        doc = add_usage_line(doc, STATS_COMMAND)
     usage = docopt.printable_usage(doc)
     all_options = docopt.parse_defaults(doc)
     pattern = docopt.parse_pattern(docopt.formal_usage(usage), all_options)
@@ -153,33 +1831,92 @@ def main():
         tokens.extend(parts)
         docopt_text = usage_lines[idx].strip(
         ) if idx < len(usage_lines) else None
-        commands.append(Command(parts, docopt_text))
+        module = line_modules[idx] if idx < len(line_modules) else None
+        commands.append(
+            Command(parts, docopt_text, required, all_options, module))
+
+    for idx, command in enumerate(commands):
+        other = next((c for c in commands[:idx] if c.module is not command.module
+                      and set(c.parts) == set(command.parts)), None)
+        if other is not None:
+            raise docopt.DocoptExit(
+                'Both {} and {} have the command "{}"'.format(
+                    other.module.name if other.module else module_name,
+                    command.module.name if command.module else module_name,
+                    " ".join(command.parts)))
+
+    if [c.parts for c in commands].count([STATS_COMMAND]) > 1:
+        raise docopt.DocoptExit(
+            '--instrument adds a "{}" command, which the usage lines already '
+            'have'.format(STATS_COMMAND))
 
     if args['--short'] is not None:
         doc = doc.replace(prompt + " ", args['--short'] + " ")
 
-    rendering = Rendering(args['<module_name>'], commands, prompt, doc,
-                          args['--multithreaded'])
+    if args['--matcher'] not in MATCHERS:
+        raise docopt.DocoptExit('Unknown matcher "{}" (expected one of: {})'.format(
+            args['--matcher'], ", ".join(MATCHERS)))
 
-    if len(rendering.tokens) > 64:
+    if args['--dispatch'] not in DISPATCHERS:
+        raise docopt.DocoptExit('Unknown dispatch "{}" (expected one of: {})'.format(
+            args['--dispatch'], ", ".join(DISPATCHERS)))
+
+    try:
+        tokens_limit = int(args['--tokens-max'])
+    except ValueError:
+        raise docopt.DocoptExit('--tokens-max is not a number: {}'.format(
+            args['--tokens-max']))
+
+    try:
+        text_limit = int(args['--text-max'])
+    except ValueError:
+        raise docopt.DocoptExit('--text-max is not a number: {}'.format(
+            args['--text-max']))
+    if not 0 < text_limit <= TEXT_LIMIT:
+        raise docopt.DocoptExit('--text-max has to be from 1 to {}: {}'.format(
+            TEXT_LIMIT, text_limit))
+
+    rendering = Rendering(module_name, commands, prompt, doc,
+                          args['--multithreaded'], args['--matcher'],
+                          args['--dispatch'], not args['--no-validation'],
+                          all_options, args['--typed-args'],
+                          args['--streaming'], tokens_limit, args['--rom'],
+                          args['--rom-read'], args['--rom-include'],
+                          args['--compress-help'], args['--completion'],
+                          args['--abbreviations'], args['--instrument'],
+                          modules, args['--resumable'], args['--binary'],
+                          text_limit)
+
+    if rendering.typed_args and not rendering.validation:
         raise docopt.DocoptExit(
-            'Too many unique tokens ({}) for Docopt μC (max:64)'.format(
-                len(rendering.tokens)))
-
-    too_long_commands = []
-    for cmd in rendering.commands:
-        if len(cmd.parts) > 6:
-            too_long_commands.append(cmd)
-
-    if too_long_commands:
-        summaries = [
-            ' > {}'.format(" ".join(p for p in c.parts))
-            for c in too_long_commands
-        ]
+            '--typed-args needs the arguments to be validated, so it can\'t '
+            'be used with --no-validation')
 
-        raise docopt.DocoptExit('\n'.join([
-            'The following commands are too long for Docopt μC (max: 6 long):'
-        ] + summaries))
+    if rendering.typed_args and rendering.resumable:
+        raise docopt.DocoptExit(
+            '--resumable needs the handlers to have the args struct (to keep '
+            'their place in), so it can\'t be used with --typed-args')
+
+    if rendering.binary and rendering.binary_clash() is not None:
+        raise docopt.DocoptExit(
+            'The binary IDs of "{}" and "{}" are the same, so one of them '
+            'needs another name'.format(*rendering.binary_clash()))
+
+    if not 0 < rendering.tokens_max <= TOKENS_LIMIT:
+        raise docopt.DocoptExit(
+            'Too many tokens ({}) for a line (max:{}), try a smaller '
+            '--tokens-max or fewer arguments'.format(rendering.tokens_max,
+                                                     TOKENS_LIMIT))
+
+    if rendering.compress_help and any(
+            ord(c) >= HELP_WORD_CODE for c in rendering.help):
+        raise docopt.DocoptExit(
+            'The help text can only be compressed if it is all ASCII')
+
+    if rendering.validation and len(rendering.options) > 64:
+        raise docopt.DocoptExit(
+            'Too many named options ({}) to validate (max:64), try '
+            '--no-validation'.format(len(rendering.options)))
 
     output_h_filename = args['--template_h'].replace(args['--template_prefix'],
                                                      rendering.include_name)
@@ -189,17 +1926,221 @@ def main():
     output_h_filename = os.path.join(args['--output_dir'], output_h_filename)
     output_c_filename = os.path.join(args['--output_dir'], output_c_filename)
 
-    with open(output_h_filename, 'w') as f:
-        f.write(args['template_h_obj'].render(rendering=rendering))
+    outputs = [(output_h_filename, template_h.render(rendering=rendering)),
+               (output_c_filename, template_c.render(rendering=rendering))]
+
+    # i.e. the header of each module's handlers
+    for module in modules:
+        filename = args['--template_h'].replace(args['--template_prefix'],
+                                                module.include_name)
+        outputs.append((os.path.join(args['--output_dir'], filename),
+                        template_h.render(rendering=rendering, module=module)))
+
+    if rendering.binary:
+        # i.e. the host's side of the frames
+        template_py = read_template_file_contents(args['--template_py'])
+        templates.append(args['--template_py'])
+        output_py_filename = os.path.join(
+            args['--output_dir'], args['--template_py'].replace(
+                args['--template_prefix'], rendering.include_name))
+        outputs.append((output_py_filename,
+                        template_py.render(rendering=rendering)))
+
+    # the args header is sized to fit this CLI (so is the module's own)
+    template_args_h = read_template_file_contents(args['--template_args_h'])
+    templates.append(args['--template_args_h'])
+    outputs.append((os.path.join(args['--output_dir'], rendering.args_header),
+                    template_args_h.render(rendering=rendering)))
+
+    if args["--no-docopt-tokenize"] is False:
+        # NB: these are the same for every module, so that they can share them
+        for option, filename in (('--template_tokenize_h', 'docopt_tokenize.h'),
+                                 ('--template_tokenize_c', 'docopt_tokenize.c')):
+            template = read_template_file_contents(args[option])
+            templates.append(args[option])
+            outputs.append((os.path.join(args['--output_dir'], filename),
+                            template.render()))
+
+    if args['--depfile']:
+        outputs.append((os.path.join(args['--output_dir'],
+                                     rendering.include_name + ".d"),
+                        depfile_text([f for f, _ in outputs],
+                                     args['<docopt_file>'] +
+                                     [template_path(t) for t in templates])))
+
+    return rendering, outputs
+
 
-    with open(output_c_filename, 'w') as f:
-        f.write(args['template_c_obj'].render(rendering=rendering))
+def size_report_text(rendering):
+    """What --report prints"""
+    lines = ["Sizes for {} (with {} byte pointers):".format(
+        rendering.module_name, POINTER_SIZE)]
+    for memory, name, size in rendering.size_report():
+        lines.append("  {:<6}{:<34}{:>6}".format(memory, name, size))
+    return "\n".join(lines)
 
-    if args["--no-docopt-args-h"] is False:
-        # copy the docopt header file to the output directory
-        docopt_args = pkg_resources.resource_filename(
-            __name__, 'templates/docopt_args.h')
-        shutil.copy2(docopt_args, args['--output_dir'])
+
+def exit_message(ex):
+    """The message of a DocoptExit, without the usage that it adds"""
+    return str(ex.code).replace(docopt.DocoptExit.usage, "").strip()
+
+
+# The options that are for the run of a --batch itself, so aren't passed on to
+# each of its lines (and only --merge can be given on one)
+BATCH_ONLY_OPTIONS = ("--batch", "--jobs", "--merge", "--measure", "--budget",
+                      "--help", "--version")
+
+
+def read_batch(args):
+    """The arguments of each line of a --batch file, as (where, args)"""
+    defaults = {o.long: o.value for o in docopt.parse_defaults(__doc__)}
+    # i.e. those given to docopt-uc (that aren't the default anyway)
+    shared = [(name, value) for name, value in args.items()
+              if name.startswith("--") and name not in BATCH_ONLY_OPTIONS
+              and value != defaults.get(name)]
+    with open(args['--batch'], 'r') as f:
+        lines = f.read().splitlines()
+
+    batch = []
+    for number, line in enumerate(lines, 1):
+        argv = shlex.split(line, comments=True)
+        if not argv:
+            continue
+        given = {a.partition("=")[0] for a in argv if a.startswith("--")}
+        argv += [name if value is True else "{}={}".format(name, value)
+                 for name, value in shared if name not in given]
+        where = "{}:{}".format(args['--batch'], number)
+        try:
+            line_args = docopt.docopt(__doc__, argv=argv, help=False)
+        except docopt.DocoptExit:
+            raise docopt.DocoptExit('{}: not a module to generate: {}'.format(
+                where, line.strip()))
+        not_here = [o for o in BATCH_ONLY_OPTIONS
+                    if o != "--merge" and line_args.get(o)
+                    and line_args[o] != defaults.get(o)]
+        if not_here:
+            raise docopt.DocoptExit('{}: {} can\'t be given for one line of '
+                                    'a --batch'.format(where, not_here[0]))
+        batch.append((where, line_args))
+    return batch
+
+
+def generate_batch_line(line):
+    """
+    Generates one line of a --batch (in a process of its own), and gives its
+    files and what --report prints, or the error that stopped it
+    """
+    where, args = line
+    try:
+        rendering, outputs = generate(args)
+    except docopt.DocoptExit as ex:
+        return where, exit_message(ex), [], None
+    report = size_report_text(rendering) if args['--report'] else None
+    return where, None, outputs, report
+
+
+def run_batch(args):
+    given = next((o for o in ("--merge", "--measure", "--budget") if args[o]),
+                 None)
+    if given is not None:
+        raise docopt.DocoptExit(
+            '{} is for one module (or shell), so it can\'t be given for a '
+            'whole --batch'.format(given))
+    batch = read_batch(args)
+    try:
+        jobs = int(args['--jobs'])
+    except ValueError:
+        raise docopt.DocoptExit('--jobs is not a number: {}'.format(
+            args['--jobs']))
+    jobs = min(jobs or os.cpu_count() or 1, len(batch))
+
+    if jobs <= 1:
+        results = [generate_batch_line(line) for line in batch]
+    else:
+        with concurrent.futures.ProcessPoolExecutor(jobs) as executor:
+            results = list(executor.map(generate_batch_line, batch))
+
+    errors = ["{}: {}".format(where, error)
+              for where, error, _, _ in results if error is not None]
+    if errors:
+        sys.exit("\n".join(errors))
+
+    # NB: e.g. a module given twice (with other options) would write its files
+    #     twice, so the modules in an --output_dir all have to give each file
+    #     the same text
+    files = {}
+    for where, _, outputs, _ in results:
+        for filename, text in outputs:
+            path = os.path.normpath(filename)
+            other = files.setdefault(path, (where, text))
+            if other[1] != text:
+                raise docopt.DocoptExit(
+                    '{} and {} would both write "{}" (but not the same), so '
+                    'give them an --output_dir each, or --merge them'.format(
+                        other[0], where, path))
+
+    for path, (_, text) in files.items():
+        write_if_changed(path, text)
+
+    for _, _, _, report in results:
+        if report is not None:
+            print(report)
+
+
+def main():
+    args = docopt.docopt(__doc__, version='none')
+
+    if args['--batch'] is not None:
+        run_batch(args)
+        return
+
+    budget = parse_budget(args['--budget']) if args['--budget'] else {}
+    rendering, outputs = generate(args)
+    for filename, text in outputs:
+        write_if_changed(filename, text)
+
+    if args['--report']:
+        print(size_report_text(rendering))
+
+    if args['--measure'] or budget:
+        compiler = args['--cc'] or find_compiler()
+        try:
+            symbols, totals, stacks = measure(rendering, args['--output_dir'],
+                                              compiler, args['--cflags'])
+        except (OSError, subprocess.CalledProcessError) as ex:
+            sys.exit('Could not measure the generated code with {}: {}'.format(
+                compiler, ex))
+
+        print("Measured with {} {}:".format(compiler, args['--cflags']))
+        for memory, name, size in symbols:
+            print("  {:<7}{:<40}{:>6}".format(memory, name, size))
+        for memory, size in totals.items():
+            print("  {:<7}{:<40}{:>6}".format(memory, "(total)", size))
+        for name, stack, unknown in stacks:
+            if stack is None:
+                print("  {:<7}{:<40}{:>6}".format("stack", name, "?"))
+                print("         (it can recurse)")
+                continue
+            print("  {:<7}{:<40}{:>6}".format("stack", name, stack))
+            if unknown:
+                # i.e. gcc's name for the calls through a pointer
+                names = sorted("(calls through a pointer)" if u ==
+                               "__indirect_call" else u for u in unknown)
+                print("         (and whatever these use: {})".format(
+                    ", ".join(names)))
+
+        totals["stack"] = max((s for _, s, _ in stacks if s is not None),
+                              default=0)
+        if any(s is None for _, s, _ in stacks):
+            totals["stack"] = None
+        over = [
+            "{} {} > {}".format(name, "unbounded" if totals[name] is None
+                                else totals[name], limit)
+            for name, limit in budget.items()
+            if totals[name] is None or totals[name] > limit
+        ]
+        if over:
+            sys.exit("Over budget: " + ", ".join(over))
 
 
 if __name__ == '__main__':
@@ -1,18 +1,68 @@
 #include "{{rendering.include_name}}_autogen.h"
+{%- for module in rendering.modules %}
+#include "{{module.include_name}}_autogen.h"
+{%- endfor %}
 
+{% if rendering.conversions -%}
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+{% endif -%}
 #include <string.h>
+{%- if rendering.rom_include %}
 
-#ifndef BV
-#  define BV(n) (((uint64_t)1) << (n))
-#endif
+#include <{{rendering.rom_include}}>
+{%- endif %}
+
+#define TOKEN_BIT(n) ((({{rendering.module_prefix}}TokenMask)1) << (n))
+
+// Where the strings and the constant tables live, and how they are read from
+// there: a value at a time, or a whole table entry into a local copy
+#define ROM {{rendering.rom if rendering.rom}}
+{% if rendering.rom_read -%}
+#define ROM_BYTE(p) {{rendering.rom_read}}_byte(p)
+#define ROM_WORD(p) {{rendering.rom_read}}_word(p)
+#define ROM_DWORD(p) {{rendering.rom_read}}_dword(p)
+#define ROM_COPY(to, from) romCopy(&(to), &(from), sizeof(to))
+
+// NB: inline, as not every CLI has tables that are copied whole
+static inline void romCopy(void *to, void const *from, size_t size) {
+    unsigned char *dst = to;
+    unsigned char const *src = from;
+    while (size-- > 0) {
+        *dst++ = ROM_BYTE(src++);
+    }
+}
+{%- else -%}
+#define ROM_BYTE(p) (*(p))
+#define ROM_WORD(p) (*(p))
+#define ROM_DWORD(p) (*(p))
+#define ROM_COPY(to, from) ((to) = (from))
+{%- endif %}
 
-#define CMD1(a)                (BV(a))
-#define CMD2(a, b)             (CMD1(a) | BV(b))
-#define CMD3(a, b, c)          (CMD2((a), (b)) | BV(c))
-#define CMD4(a, b, c, d)       (CMD3((a), (b), (c)) | BV(d))
-#define CMD5(a, b, c, d, e)    (CMD4((a), (b), (c), (d)) | BV(e))
-#define CMD6(a, b, c, d, e, f) (CMD5((a), (b), (c), (d), (e)) | BV(f))
+{% if rendering.opcode_words == 1 -%}
+#define OPCODE_BIT(n)          ((({{rendering.module_prefix}}Opcode)1) << (n))
+#define OPCODE_TEST(op, n)     (((op) & OPCODE_BIT(n)) != 0)
+#define OPCODE_SET(op, n)      ((op) |= OPCODE_BIT(n))
+#define OPCODE_CLEAR(op, n)    ((op) &= ~OPCODE_BIT(n))
 
+{% for length in range(1, rendering.longest_command + 1) -%}
+{% set params = length|macro_params -%}
+{{("#define CMD%d(%s)"|format(length, params|join(", "))).ljust(30)}} {% if length == 1 -%}
+(OPCODE_BIT(a))
+{%- elif length == 2 -%}
+(CMD1(a) | OPCODE_BIT(b))
+{%- else -%}
+(CMD{{length - 1}}({% for p in params[:-1] %}({{p}}){{", " if not loop.last}}{% endfor %}) | OPCODE_BIT({{params[-1]}}))
+{%- endif %}
+{% endfor -%}
+{%- else -%}
+#define OPCODE_BIT(n)          ((({{rendering.module_prefix}}OpcodeWord)1) << ((n) % {{rendering.include_name|upper}}_ARGS_OPCODE_WORD_BITS))
+#define OPCODE_WORD(op, n)     ((op)[(n) / {{rendering.include_name|upper}}_ARGS_OPCODE_WORD_BITS])
+#define OPCODE_TEST(op, n)     ((OPCODE_WORD(op, n) & OPCODE_BIT(n)) != 0)
+#define OPCODE_SET(op, n)      (OPCODE_WORD(op, n) |= OPCODE_BIT(n))
+#define OPCODE_CLEAR(op, n)    (OPCODE_WORD(op, n) &= ~OPCODE_BIT(n))
+{% endif %}
 // https://stackoverflow.com/questions/807244/c-compiler-asserts-how-to-implement
 /** A compile time assertion check.
  *
@@ -56,133 +106,1998 @@ enum {
 // Check will fit in opcode bitmap
 // https://stackoverflow.com/questions/3553296/sizeof-single-struct-member-in-c
 #define FIELD_SIZEOF(t, f) (sizeof(((t*)0)->f))
-CASSERT(LAST < (FIELD_SIZEOF(DocoptArgs, opcode) * 8), __file__);
+CASSERT(LAST <= (FIELD_SIZEOF({{rendering.module_prefix}}Args, opcode) * 8), __file__);
 
-static const char *Names[] = {
-  // AUTOGEN NAMES OF OPTIONS - START
-  {% for token in rendering.tokens -%}
-  "{{token}}",
+{% set tokenType = rendering.tokens|length|c_int_type -%}
+#define NO_TOKEN (-1)
+
+{% set options = rendering.options -%}
+{% set optionType = (options|length + 2)|c_int_type -%}
+#define NO_OPTION (-1)
+#define HELP_OPTION (-2)
+
+{% if options -%}
+enum {
+  OPTION_COUNT = {{rendering.include_name|upper}}_OPTION_COUNT,
+};
+
+CASSERT((int)OPTION_COUNT <= (int){{rendering.include_name|upper}}_ARGS_OPTIONS_MAX, __file__);
+
+// If each option takes a value (e.g. "--speed=<kn>"), or is a flag
+static const bool OptionHasValue[] ROM = {
+  // AUTOGEN OPTIONS WITH VALUES - START
+  {% for option in options -%}
+  {{"true" if option.has_value else "false"}}, // {{rendering.option_enum(option.name)}}
+  {% endfor -%}
+  // AUTOGEN OPTIONS WITH VALUES - END
+};
+
+{% endif -%}
+{% if rendering.compress_help -%}
+// The words of the compressed help text, and any names that aren't already
+// part of them
+{%- else -%}
+// The help text, followed by any names that aren't already part of it
+{%- endif %}
+static const char Strings[] ROM = {
+  // AUTOGEN STRINGS - START
+  {% for literal in rendering.strings.literals -%}
+  {{literal}}
+  {% endfor -%}
+  // AUTOGEN STRINGS - END
+};
+
+{% if rendering.compress_help -%}
+{% set help = "Help" -%}
+// The compressed help text, in which each byte from HELP_WORD_CODE up is a
+// word of HelpWordOffsets and HelpWordLengths
+enum { HELP_WORD_CODE = 0x80 };
+
+static const char Help[] ROM = {
+  // AUTOGEN HELP - START
+  {% for literal in rendering.help_literals -%}
+  {{literal}}
+  {% endfor -%}
+  // AUTOGEN HELP - END
+};
+
+// Where each word is in the Strings
+static const uint16_t HelpWordOffsets[] ROM = {
+  {{rendering.help_word_offsets|join(", ")}}
+};
+
+static const uint8_t HelpWordLengths[] ROM = {
+  {{rendering.compressed_help[0]|map("length")|join(", ")}}
+};
+
+{% else -%}
+{% set help = "Strings" -%}
+{% endif -%}
+// Where each line of the help text starts in the {{help}}, and where the
+// last one ends
+static const uint16_t HelpLines[] ROM = {
+  {{rendering.help_line_offsets|join(", ")}}
+};
+
+{# A matcher for a list of names, which gives the C value of the one that
+    matches the whole of its argument (or noMatch) -#}
+{% macro matcher(kind, trie, names, values, resultType, noMatch, description) -%}
+{% if rendering.matcher == "trie" -%}
+{% set trieType = trie.tokens|length|c_uint_type -%}
+typedef struct {
+  char c;
+  {{trieType}} next;
+} {{kind}}TrieEdge;
+
+// The edges leaving node n are {{kind}}TrieEdges[{{kind}}TrieFirstEdge[n]] up
+// to (but not including) {{kind}}TrieEdges[{{kind}}TrieFirstEdge[n + 1]],
+// sorted by character.
+static const {{trieType}} {{kind}}TrieFirstEdge[] ROM = {
+  // AUTOGEN {{kind|upper}} TRIE NODES - START
+  {% for first in trie.first_edge -%}
+  {{first}},
+  {% endfor -%}
+  // AUTOGEN {{kind|upper}} TRIE NODES - END
+};
+
+static const {{kind}}TrieEdge {{kind}}TrieEdges[] ROM = {
+  // AUTOGEN {{kind|upper}} TRIE EDGES - START
+  {% for c, next in trie.edges -%}
+  { {{c|c_char}}, {{next}} },
+  {% endfor -%}
+  // AUTOGEN {{kind|upper}} TRIE EDGES - END
+};
+
+// The {{description}} that ends at each node (if any)
+static const {{resultType}} {{kind}}TrieMatch[] ROM = {
+  // AUTOGEN {{kind|upper}} TRIE MATCHES - START
+  {% for name in trie.tokens -%}
+  {{values[name] if name is not none else noMatch}},
   {% endfor -%}
-  // AUTOGEN NAMES OF OPTIONS - END
+  // AUTOGEN {{kind|upper}} TRIE MATCHES - END
 };
 
 /**
- * Parses the arguments into the DocoptArgs struct.
+ * Follows the edge for the next character from a node of the trie.
  *
- * NB: Command tokens are only entered into the opcode once, so if a command 
- *     token is present more than once the following copies will be inserted
- *     into the positional arguments list.
+ * Returns false if there is no such edge (i.e. nothing can match).
  */
-static enum DocoptError parseArgs(DocoptArgs *args, uint8_t argc, char **argv) {
-  memset(args, 0, sizeof(DocoptArgs));
+static bool step{{kind}}({{trieType}} *node, char c) {
+  {{trieType}} edge = {{trieType|rom_read}}(&{{kind}}TrieFirstEdge[*node]);
+  {{trieType}} end = {{trieType|rom_read}}(&{{kind}}TrieFirstEdge[*node + 1]);
 
-  if (argc > DOCOPT_ARGS_TOKENS_MAX) {
-    return DOCOPT_ERROR_TOO_MANY_TOKENS;
+  while ((edge < end) && ((char)ROM_BYTE(&{{kind}}TrieEdges[edge].c) < c)) {
+    edge++;
   }
+  if ((edge == end) || ((char)ROM_BYTE(&{{kind}}TrieEdges[edge].c) != c)) {
+    return false;
+  }
+  *node = {{trieType|rom_read}}(&{{kind}}TrieEdges[edge].next);
+  return true;
+}
 
-  // find all matching commands. 
-  // NB: argsConsumed needs to have sufficient bits for the DOCOPT_ARGS_TOKENS_MAX 
-  //     number of tokens (not the opcode bit width)
-  uint32_t argsConsumed = 0;
-  CASSERT(LAST < (sizeof(argsConsumed) * 8), __file__);
+/**
+ * Finds the {{description}} that matches the argument, in a single pass over
+ * the argument's characters.
+ *
+ * Returns {{noMatch}} if the argument is not a {{description}}.
+ */
+static {{resultType}} match{{kind}}(char const *arg, uint8_t length) {
+  {{trieType}} node = 0;
 
-  for (int i = 0; i < argc; i++) {
-    char *arg = argv[i];
-
-    // do help first, as it is a bit of a special case
-    if (!args->help) {
-      if ((strcmp("?", arg) == 0) || (strcmp("-h", arg) == 0) || 
-          (strcmp("--help", arg) == 0)) {
-        args->help = true;
-        argsConsumed |= BV(i);
-        continue;
-      }
+  for (uint8_t i = 0; i < length; i++) {
+    if (!step{{kind}}(&node, arg[i])) {
+      return {{noMatch}};
     }
-    
-    for (int j = 0; j < LAST; j++) {
-      if ((args->opcode & BV(j)) != 0) {
-         continue;  // no need to check this one again
-      }
-      if (strcmp(Names[j], arg) == 0) {
-         args->opcode |= BV(j);
-         argsConsumed |= BV(i);
-         break;
-      }
+  }
+  return {{resultType|rom_read}}(&{{kind}}TrieMatch[node]);
+}
+{%- else -%}
+// Where each name is in the Strings
+static const uint16_t {{kind}}NameOffsets[] ROM = {
+  // AUTOGEN {{kind|upper}} NAMES - START
+  {% for name in names -%}
+  {{rendering.strings.offsets[name]}}, // {{name}}
+  {% endfor -%}
+  // AUTOGEN {{kind|upper}} NAMES - END
+};
+
+static const uint8_t {{kind}}NameLengths[] ROM = {
+  {% for name in names -%}
+  {{name|length}},
+  {% endfor -%}
+};
+
+static const {{resultType}} {{kind}}Values[] ROM = {
+  // AUTOGEN {{kind|upper}} VALUES - START
+  {% for value in values -%}
+  {{value}},
+  {% endfor -%}
+  // AUTOGEN {{kind|upper}} VALUES - END
+};
+
+/**
+ * Finds the {{description}} that matches the argument, by comparing it with
+ * each of the names.
+ *
+ * Returns {{noMatch}} if the argument is not a {{description}}.
+ */
+static {{resultType}} match{{kind}}(char const *arg, uint8_t length) {
+  {%- if rendering.abbreviations %}
+  {{resultType}} prefixOf = {{noMatch}};
+  uint8_t prefixes = 0; // i.e. the names that the argument is the start of
+  {%- endif %}
+  for (int j = 0; j < {{names|length}}; j++) {
+    {%- if rendering.abbreviations %}
+    uint16_t offset = ROM_WORD(&{{kind}}NameOffsets[j]);
+    uint8_t nameLength = ROM_BYTE(&{{kind}}NameLengths[j]);
+    if (matchesString(offset, nameLength, arg, length)) {
+      return {{resultType|rom_read}}(&{{kind}}Values[j]);
+    }
+    if ((length > 0) && (nameLength > length) &&
+        startsWith(offset, arg, length)) {
+      prefixOf = {{resultType|rom_read}}(&{{kind}}Values[j]);
+      prefixes++;
+    }
+    {%- else %}
+    if (matchesString(ROM_WORD(&{{kind}}NameOffsets[j]),
+                      ROM_BYTE(&{{kind}}NameLengths[j]), arg, length)) {
+      return {{resultType|rom_read}}(&{{kind}}Values[j]);
+    }
+    {%- endif %}
+  }
+  {%- if rendering.abbreviations %}
+  return (prefixes == 1) ? prefixOf : {{noMatch}};
+  {%- else %}
+  return {{noMatch}};
+  {%- endif %}
+}
+{%- endif %}
+{%- endmacro -%}
+
+{% if rendering.matcher == "strcmp" -%}
+/**
+ * Compares the argument with the start of the string at this offset of the
+ * Strings.
+ */
+static bool startsWith(uint16_t offset, char const *arg, uint8_t length) {
+  for (uint8_t i = 0; i < length; i++) {
+    if (ROM_BYTE(&Strings[offset + i]) != arg[i]) {
+      return false;
     }
   }
+  return true;
+}
+
+/**
+ * Compares the argument with the string at this offset of the Strings.
+ */
+static bool matchesString(uint16_t offset, uint8_t stringLength,
+                          char const *arg, uint8_t length) {
+  return (stringLength == length) && startsWith(offset, arg, length);
+}
+
+{% endif -%}
+{{ matcher("Token", rendering.token_trie, rendering.tokens,
+           rendering.tokens|escape_c_keywords, tokenType, "NO_TOKEN",
+           "command token") }}
+
+{{ matcher("Option", rendering.option_trie, rendering.option_names,
+           rendering.option_values, optionType, "NO_OPTION",
+           "long option name") }}
+
+/**
+ * Finds the option with this letter (e.g. the "m" of "-m").
+ *
+ * Returns NO_OPTION if no option has that letter.
+ */
+static {{optionType}} matchShortOption(char c) {
+  switch (c) {
+    // AUTOGEN SHORT OPTIONS - START
+    {% for c, index in rendering.short_options -%}
+    case {{c|c_char}}:
+      return {{rendering.option_enum(options[index].name) if index is not none else "HELP_OPTION"}};
+    {% endfor -%}
+    // AUTOGEN SHORT OPTIONS - END
+    default:
+      return NO_OPTION;
+  }
+}
+
+static bool takesValue({{optionType}} option) {
+  {% if options -%}
+  return (option >= 0) && ROM_BYTE(&OptionHasValue[option]);
+  {%- else -%}
+  (void)option;
+  return false;
+  {%- endif %}
+}
+
+// An argument, as a slice of the text it came from (which isn't changed)
+typedef DocoptToken Arg;
+
+/**
+ * Keeps a (NUL terminated) copy of the text of an argument in args->text,
+ * without its quotes if it came from a line.
+ *
+ * Returns NULL if there isn't room for it.
+ */
+static char *saveText({{rendering.module_prefix}}Args *args, char const *text, uint8_t length,
+                      bool unescape) {
+  if (length >= sizeof(args->text) - args->textUsed) {
+    return NULL;
+  }
 
-  // Collect anything that was not a command
+  char *saved = &args->text[args->textUsed];
+  if (unescape) {
+    length = Docopt_unescape(text, length, saved);
+  } else {
+    memcpy(saved, text, length);
+  }
+  saved[length] = '\0';
+  args->textUsed += length + 1;
+  return saved;
+}
+
+{% if options -%}
+// The value in the slot of a flag that was given
+static char FlagGiven[] = "";
+
+{% endif -%}
+/**
+ * Fills in the slot of a known option (or asks for help), checking that it
+ * has a value if (and only if) it takes one.
+ */
+static enum DocoptError setOption({{rendering.module_prefix}}Args *args, {{optionType}} option,
+                                  char const *value, uint8_t valueLength,
+                                  bool unescape) {
+  if (option == HELP_OPTION) {
+    args->help = true;
+    return DOCOPT_NO_ERROR;
+  }
+  if (takesValue(option) != (value != NULL)) {
+    return DOCOPT_ERROR_OPTION_VALUE;
+  }
+  {% if options -%}
+  if (value == NULL) {
+    args->optionValue[option] = FlagGiven;
+    return DOCOPT_NO_ERROR;
+  }
+
+  args->optionValue[option] = saveText(args, value, valueLength, unescape);
+  if (args->optionValue[option] == NULL) {
+    return DOCOPT_ERROR_TOO_LONG;
+  }
+  {%- else -%}
+  (void)valueLength;
+  (void)unescape;
+  {%- endif %}
+  return DOCOPT_NO_ERROR;
+}
+
+/**
+ * Collects the arguments that are not command tokens (i.e. the ones not in
+ * consumed) into the args.
+ *
+ * NB: Options are looked up once here, and known options go into their slot
+ *     of optionValue.
+{%- if rendering.named_max %} Options that aren't known go into namedLabel and
+ *     namedValue.
+{%- else %} Options that aren't known are rejected, as there is
+ *     no usage line they could be in.
+{%- endif %}
+ *
+ * NB: The arguments are only read, and the values are copied into args->text
+ *     (without their quotes, if unescape is set).
+ */
+static enum DocoptError collectArgs({{rendering.module_prefix}}Args *args, Arg const *argv,
+                                    uint8_t argc, {{rendering.module_prefix}}TokenMask consumed,
+                                    bool unescape) {
   enum DocoptError err = DOCOPT_NO_ERROR;
   for (int i = 0; i < argc; i++)
   {
-     if ((BV(i) & argsConsumed) != 0)
+     if ((TOKEN_BIT(i) & consumed) != 0)
      {
          continue;
      }
 
-     char *arg = argv[i];
-     if (arg[0] == '-' && arg[1] == '-') {
-        args->namedLabel[args->namedCount] = &arg[2];
-        args->namedValue[args->namedCount] = NULL;
-
-        while (*arg != '\0') {
-          if (*arg == '=') {
-            *arg = '\0';
-            args->namedValue[args->namedCount] = arg + 1;
-            break;
-          }
-          arg++;
+     char const *text = argv[i].text;
+     uint8_t length = argv[i].length;
+
+     if ((length < 2) || (text[0] != '-') ||
+         ((text[1] >= '0') && (text[1] <= '9'))) {
+        // i.e. not an option (including "-" and negative numbers)
+        {%- if rendering.positional_max %}
+        if (args->posCount >= {{rendering.include_name|upper}}_ARGS_POSITIONAL_ARGS_MAX) {
+          return DOCOPT_ERROR_TOO_MANY_POSITIONAL;
         }
-        args->namedCount++;
+        char *value = saveText(args, text, length, unescape);
+        if (value == NULL) {
+          return DOCOPT_ERROR_TOO_LONG;
+        }
+        args->posValue[args->posCount++] = value;
+        {%- else %}
+        return DOCOPT_ERROR_TOO_MANY_POSITIONAL;
+        {%- endif %}
      } else {
-        args->posValue[args->posCount++] = arg;
-     }
+        char const *name;
+        uint8_t nameLength;
+        char const *value = NULL;
+        uint8_t valueLength = 0;
+        {{optionType}} option;
 
-     if (args->posCount >= DOCOPT_ARGS_POSITIONAL_ARGS_MAX) {
-        err = DOCOPT_ERROR_TOO_MANY_NAMED;
-        break;
-     }
-     if (args->namedCount >= DOCOPT_ARGS_NAMED_ARGS_MAX) {
-        err = DOCOPT_ERROR_TOO_MANY_POSITIONAL;
-        break;
+        if (text[1] == '-') {
+           // i.e. "--name", "--name=value" or "--name value"
+           name = &text[2];
+           nameLength = length - 2;
+           char const *equals = memchr(name, '=', nameLength);
+           if (equals != NULL) {
+             value = equals + 1;
+             valueLength = (uint8_t)(&text[length] - value);
+             nameLength = (uint8_t)(equals - name);
+           }
+           option = matchOption(name, nameLength);
+        } else {
+           // i.e. short options, which can be bundled ("-md"), and the last
+           // of which can have a value ("-s10" or "-s 10")
+           name = &text[1];
+           nameLength = 1;
+           uint8_t rest = length - 2; // i.e. after this option's letter
+           option = matchShortOption(*name);
+           while ((option != NO_OPTION) && !takesValue(option) && (rest > 0)) {
+             err = setOption(args, option, NULL, 0, unescape);
+             if (err != DOCOPT_NO_ERROR) {
+               return err;
+             }
+             name++;
+             rest--;
+             option = matchShortOption(*name);
+           }
+           if (takesValue(option) && (rest > 0)) {
+             value = &name[1];
+             valueLength = rest;
+           } else {
+             nameLength += rest; // i.e. an unknown option, and the rest
+           }
+        }
+
+        if ((value == NULL) && takesValue(option) && (i + 1 < argc) &&
+            ((TOKEN_BIT(i + 1) & consumed) == 0)) {
+           i++;
+           value = argv[i].text;
+           valueLength = argv[i].length;
+        }
+
+        if (option != NO_OPTION) {
+           err = setOption(args, option, value, valueLength, unescape);
+           if (err != DOCOPT_NO_ERROR) {
+             return err;
+           }
+        } else {
+           {%- if rendering.named_max %}
+           if (args->namedCount >= {{rendering.include_name|upper}}_ARGS_NAMED_ARGS_MAX) {
+             return DOCOPT_ERROR_TOO_MANY_NAMED;
+           }
+           char *label = saveText(args, name, nameLength, unescape);
+           char *saved = NULL;
+           if (value != NULL) {
+             saved = saveText(args, value, valueLength, unescape);
+           }
+           if ((label == NULL) || ((value != NULL) && (saved == NULL))) {
+             return DOCOPT_ERROR_TOO_LONG;
+           }
+           args->namedLabel[args->namedCount] = label;
+           args->namedValue[args->namedCount] = saved;
+           args->namedCount++;
+           {%- else %}
+           return DOCOPT_ERROR_UNKNOWN_OPTION;
+           {%- endif %}
+        }
      }
   }
   return err;
 }
 
-char const *{{rendering.module_prefix}}_processCommand(uint8_t argc, char **argv)
-{
-  {%- if rendering.multithreaded %}
-  DocoptArgs docoptArgs; // Lives on the stack
-  {% else %}
-  static DocoptArgs docoptArgs; // Shared between all calls
+/**
+ * Parses the arguments into the args.
+ *
+ * NB: Command tokens are only entered into the opcode once, so if a command 
+ *     token is present more than once the following copies will be inserted
+ *     into the positional arguments list.
+ */
+static enum DocoptError parseArgs({{rendering.module_prefix}}Args *args, Arg const *argv,
+                                  uint8_t argc, bool unescape) {
+  memset(args, 0, sizeof({{rendering.module_prefix}}Args));
+
+  if (argc > {{rendering.include_name|upper}}_ARGS_TOKENS_MAX) {
+    return DOCOPT_ERROR_TOO_MANY_TOKENS;
+  }
+
+  // find all matching commands. 
+  // NB: argsConsumed needs to have sufficient bits for the {{rendering.include_name|upper}}_ARGS_TOKENS_MAX 
+  //     number of tokens (not the opcode bit width)
+  {{rendering.module_prefix}}TokenMask argsConsumed = 0;
+  CASSERT({{rendering.include_name|upper}}_ARGS_TOKENS_MAX <= (sizeof(argsConsumed) * 8), __file__);
+
+  for (int i = 0; i < argc; i++) {
+    Arg const *arg = &argv[i];
+
+    // options (and negative numbers) are collected below
+    if ((arg->length > 0) && (arg->text[0] == '-')) {
+      continue;
+    }
+
+    // "?" is asking for help, the same as "-h" and "--help"
+    if ((arg->length == 1) && (arg->text[0] == '?')) {
+      args->help = true;
+      argsConsumed |= TOKEN_BIT(i);
+      continue;
+    }
+
+    {{tokenType}} token = matchToken(arg->text, arg->length);
+    if ((token != NO_TOKEN) && !OPCODE_TEST(args->opcode, token)) {
+      OPCODE_SET(args->opcode, token);
+      argsConsumed |= TOKEN_BIT(i);
+    }
+  }
+
+  return collectArgs(args, argv, argc, argsConsumed, unescape);
+}
+
+typedef char const *(*CommandHandler)({{rendering.module_prefix}}Args *args);
+
+{% macro handler(command) -%}
+{% if rendering.typed_args -%}
+call_{{command.function_name}}
+{%- else -%}
+{{rendering.handler_prefix(command)}}_handle_{{command.function_name}}
+{%- endif %}
+{%- endmacro -%}
+{% set commandIndexType = rendering.commands|length|c_uint_type -%}
+{% if rendering.validation -%}
+{% set groups = rendering.exclusive_groups -%}
+{% set optionMaskType = rendering.option_mask_type -%}
+// i.e. a bit for each number of positional arguments that a command takes
+typedef {{rendering.positional_mask_type}} PositionalMask;
+
+{% if rendering.options -%}
+#define OPTION_BIT(n) (((OptionMask)1) << (n))
+
+typedef {{optionMaskType}} OptionMask;
+
+{% if groups -%}
+typedef struct {
+  OptionMask options;
+  bool required; // i.e. exactly one of them, instead of at most one
+} ExclusiveOptions;
+
+static const ExclusiveOptions ExclusiveGroups[] ROM = {
+  // AUTOGEN EXCLUSIVE OPTIONS - START
+  {% for mask, required in groups -%}
+  { {{"0x%x"|format(mask)}}, {{"true" if required else "false"}} },
+  {% endfor -%}
+  // AUTOGEN EXCLUSIVE OPTIONS - END
+};
+
+{% endif -%}
+{% endif -%}
+typedef struct {
+  PositionalMask positionalCounts;
+  {% if rendering.options -%}
+  OptionMask allowedOptions;
+  OptionMask requiredOptions;
+  {% if groups -%}
+  uint8_t firstGroup;
+  uint8_t groupCount;
+  {%- endif %}
+  {%- endif %}
+} CommandRules;
+
+// The arguments each command accepts, from its usage line
+static const CommandRules Rules[] ROM = {
+  // AUTOGEN COMMAND RULES - START
+  {% for rule in rendering.rules -%}
+  // > {{rule.command.docopt_text}}
+  { {{"0x%x"|format(rule.positional_counts)}}
+    {%- if rendering.options -%}
+    , {{"0x%x"|format(rule.allowed_options)}}, {{"0x%x"|format(rule.required_options)}}
+    {%- if groups -%}
+    , {{rule.first_group}}, {{rule.group_count}}
+    {%- endif -%}
+    {%- endif %} },
+  {% endfor -%}
+  // AUTOGEN COMMAND RULES - END
+};
+
+/**
+ * Checks the positional and named arguments against the usage line of the
+ * command, so the handlers don't have to.
+ */
+static enum DocoptError validateArgs({{rendering.module_prefix}}Args const *args,
+                                     CommandRules const *rules) {
+  PositionalMask count = ((PositionalMask)1) << args->posCount;
+  if ((rules->positionalCounts & count) == 0) {
+    // i.e. whether it would take fewer of them, or only more
+    return ((rules->positionalCounts & (count - 1)) != 0)
+               ? DOCOPT_ERROR_UNEXPECTED_POSITIONAL
+               : DOCOPT_ERROR_MISSING_POSITIONAL;
+  }
+
+  {% if rendering.options -%}
+  OptionMask present = 0;
+  for (int i = 0; i < OPTION_COUNT; i++) {
+    if (args->optionValue[i] != NULL) {
+      present |= OPTION_BIT(i);
+    }
+  }
+
+  if ((present & ~rules->allowedOptions) != 0) {
+    return DOCOPT_ERROR_UNKNOWN_OPTION;
+  }
+  if ((present & rules->requiredOptions) != rules->requiredOptions) {
+    return DOCOPT_ERROR_MISSING_OPTION;
+  }
+  {%- if groups %}
+
+  for (int i = 0; i < rules->groupCount; i++) {
+    ExclusiveOptions group;
+    ROM_COPY(group, ExclusiveGroups[rules->firstGroup + i]);
+    OptionMask used = present & group.options;
+    if (((used & (used - 1)) != 0) || (group.required && (used == 0))) {
+      return DOCOPT_ERROR_EXCLUSIVE_OPTIONS;
+    }
+  }
+  {%- endif %}
+  {% endif -%}
+  return DOCOPT_NO_ERROR;
+}
+
+{% endif -%}
+{% if rendering.typed_args -%}
+{% if "int32_t" in rendering.conversions -%}
+// NB: in decimal (so "010" is 10), and out of range is a bad value rather than
+//     being cut down to 32 bits
+static bool toInt32(char const *s, int32_t *value) {
+  char *end;
+  errno = 0;
+  long result = strtol(s, &end, 10);
+  if ((end == s) || (*end != '\0') || (errno == ERANGE)) {
+    return false;
+  }
+#if LONG_MAX > INT32_MAX
+  if ((result < INT32_MIN) || (result > INT32_MAX)) {
+    return false;
+  }
+#endif
+  *value = (int32_t)result;
+  return true;
+}
+
+{% endif -%}
+{% if "uint32_t" in rendering.conversions -%}
+static bool toUint32(char const *s, uint32_t *value) {
+  char *end;
+  // i.e. strtoul would take "-1" (or " -1") to be ULONG_MAX
+  if ((s[0] < '0') || (s[0] > '9')) {
+    return false;
+  }
+  errno = 0;
+  unsigned long result = strtoul(s, &end, 10);
+  if ((*end != '\0') || (errno == ERANGE)) {
+    return false;
+  }
+#if ULONG_MAX > UINT32_MAX
+  if (result > UINT32_MAX) {
+    return false;
+  }
+#endif
+  *value = (uint32_t)result;
+  return true;
+}
+
+{% endif -%}
+{% macro convert(field, value) -%}
+{% if field.ctype == "int32_t" -%}
+ok = ok && toInt32({{value}}, &typed.{{field.name}});
+{%- elif field.ctype == "uint32_t" -%}
+ok = ok && toUint32({{value}}, &typed.{{field.name}});
+{%- elif field.ctype == "bool" -%}
+typed.{{field.name}} = true;
+{%- else -%}
+typed.{{field.name}} = {{value}};
+{%- endif %}
+{%- endmacro -%}
+// AUTOGEN TYPED ARGUMENT CONVERSIONS - START
+{% for command in rendering.commands -%}
+{% set fields = rendering.fields(command) -%}
+static char const *call_{{command.function_name}}({{rendering.module_prefix}}Args *args) {
+  {% if fields -%}
+  {{rendering.typed_args_name(command)}} typed = {
+    {%- for field in fields %}
+    {%- if field.repeated %}
+    .{{field.name}} = &args->posValue[{{field.position}}],
+    .{{field.name}}Count = args->posCount - {{field.position + field.trailing}},
+    {%- else %}
+    .{{field.name}} = {{field.initial_value}},
+    {%- endif %}
+    {%- endfor %}
+  };
+  {% if rendering.converts(command) -%}
+  bool ok = true;
+  {% endif -%}
+  {% for field in fields if field.position is not none and not field.repeated -%}
+  if ({{field.present}}) {
+    {{convert(field, field.value)}}
+  }
+  {% endfor -%}
+  {% for field in fields if field.option -%}
+  {% set slot = "args->optionValue[%s]"|format(rendering.option_enum(field.option)) -%}
+  if ({{slot}} != NULL) {
+    {{convert(field, slot)}}
+  }
+  {% endfor -%}
+  {% if rendering.converts(command) -%}
+  if (!ok) {
+    args->error = DOCOPT_ERROR_BAD_VALUE;
+    return {{rendering.module_prefix}}_handle_Error(args);
+  }
   {% endif -%}
-  int errNo = parseArgs(&docoptArgs, argc, argv); 
+  return {{rendering.handler_prefix(command)}}_handle_{{command.function_name}}(&typed);
+  {%- else -%}
+  (void)args;
+  return {{rendering.handler_prefix(command)}}_handle_{{command.function_name}}();
+  {%- endif %}
+}
+
+{% endfor -%}
+// AUTOGEN TYPED ARGUMENT CONVERSIONS - END
+
+{% endif -%}
+{% if rendering.instrument -%}
+{% set instrument = rendering.include_name|upper + "_INSTRUMENT" -%}
+{% set cycles = rendering.module_prefix + "Cycles" -%}
+#if {{instrument}}
+{%- if rendering.resumable %}
+// NB: call is false for the later slices of a command, which aren't calls of
+//     it (so each of them is timed, but the command is only counted once)
+static void addTiming({{rendering.module_prefix}}Timing *timing, {{cycles}} start, bool call) {
+{%- else %}
+static void addTiming({{rendering.module_prefix}}Timing *timing, {{cycles}} start) {
+{%- endif %}
+  {{cycles}} cycles = {{rendering.module_prefix}}_timestamp() - start;
+  if ((timing->calls == 0) || (cycles < timing->min)) {
+    timing->min = cycles;
+  }
+  if (cycles > timing->max) {
+    timing->max = cycles;
+  }
+  timing->total += cycles;
+  {%- if rendering.resumable %}
+  if (call) {
+    timing->calls++;
+  }
+  {%- else %}
+  timing->calls++;
+  {%- endif %}
+}
+
+// i.e. into the stats of the context
+#define TIMING_START(start) {{cycles}} start = {{rendering.module_prefix}}_timestamp()
+{%- if rendering.resumable %}
+#define TIMING_END(ctx, timing, start) \
+  addTiming(&(ctx)->stats.timing, start, !(ctx)->resuming)
+{%- else %}
+#define TIMING_END(ctx, timing, start) addTiming(&(ctx)->stats.timing, start)
+{%- endif %}
+#define COUNT_ERROR(ctx, error) ((ctx)->stats.errors[error]++)
+{%- if rendering.resumable %}
+#define RESUMING(ctx, on) ((ctx)->resuming = (on))
+#define CLEAR_STATS(ctx) \
+  (memset(&(ctx)->stats, 0, sizeof((ctx)->stats)), RESUMING(ctx, false))
+{%- else %}
+#define CLEAR_STATS(ctx) memset(&(ctx)->stats, 0, sizeof((ctx)->stats))
+{%- endif %}
+#else
+#define TIMING_START(start)
+#define TIMING_END(ctx, timing, start)
+#define COUNT_ERROR(ctx, error)
+#define CLEAR_STATS(ctx)
+{%- if rendering.resumable %}
+#define RESUMING(ctx, on)
+{%- endif %}
+#endif
+
+{% endif -%}
+/**
+ * Calls the handler for the command, once its arguments have been checked.
+ *
+{%- if rendering.typed_args %}
+ * NB: Asking for help goes to the help handler, as the typed handlers only
+ *     ever get valid arguments.
+{%- else %}
+ * NB: Asking for help skips the checks, so the handler can give it.
+{%- endif %}
+ */
+static char const *runHandler({{rendering.module_prefix}}Context *ctx, {{commandIndexType}} command,
+                              CommandHandler handler) {
+  {{rendering.module_prefix}}Args *args = &ctx->args;
+  {% if rendering.typed_args or rendering.validation -%}
+  CommandRules rules;
+  ROM_COPY(rules, Rules[command]);
+  {% endif -%}
+  {% if rendering.typed_args -%}
+  if (args->help) {
+    return {{rendering.module_prefix}}_handle_Help(args);
+  }
+  args->error = validateArgs(args, &rules);
+  if (args->error != DOCOPT_NO_ERROR) {
+    return {{rendering.module_prefix}}_handle_Error(args);
+  }
+  {% elif rendering.validation -%}
+  if (!args->help) {
+    args->error = validateArgs(args, &rules);
+    if (args->error != DOCOPT_NO_ERROR) {
+      return {{rendering.module_prefix}}_handle_Error(args);
+    }
+  }
+  {% endif -%}
+  {% if rendering.instrument -%}
+  TIMING_START(timingStart);
+  char const *result = handler(args);
+  TIMING_END(ctx, commands[command], timingStart);
+  return result;
+  {%- else -%}
+  return handler(args);
+  {%- endif %}
+}
+
+{% if rendering.dispatch == "table" -%}
+{% if rendering.opcode_words == 1 -%}
+typedef struct {
+  {{rendering.module_prefix}}Opcode opcode;
+  CommandHandler handler;
+  {{commandIndexType}} index; // i.e. in the order of the usage lines
+} Command;
+
+// Sorted by opcode, for the binary search in findCommand()
+static const Command Commands[] ROM = {
+  // AUTOGEN TABLE OF COMMAND COMBINATIONS - START
+  {% for command in rendering.commands_by_opcode -%}
+  { CMD{{command.parts|length}}({{command.parts|escape_c_keywords|join(", ")}}), {{handler(command)}}, {{rendering.commands.index(command)}} },
+  {% endfor -%}
+  // AUTOGEN TABLE OF COMMAND COMBINATIONS - END
+};
+{%- else -%}
+typedef struct {
+  {{rendering.module_prefix}}OpcodeWord opcode[{{rendering.include_name|upper}}_ARGS_OPCODE_WORDS];
+  CommandHandler handler;
+  {{commandIndexType}} index; // i.e. in the order of the usage lines
+} Command;
+
+// Sorted by opcode (most significant word last), for the binary search in
+// findCommand()
+static const Command Commands[] ROM = {
+  // AUTOGEN TABLE OF COMMAND COMBINATIONS - START
+  {% for command in rendering.commands_by_opcode -%}
+  // > {{command.parts|join(" ")}}
+  { { {% for word in rendering.opcode_word_values(command) %}{{"0x%08xu"|format(word)}}{{", " if not loop.last}}{% endfor %} }, {{handler(command)}}, {{rendering.commands.index(command)}} },
+  {% endfor -%}
+  // AUTOGEN TABLE OF COMMAND COMBINATIONS - END
+};
+
+static int compareOpcodes({{rendering.module_prefix}}OpcodeWord const *a, {{rendering.module_prefix}}OpcodeWord const *b) {
+  for (int i = {{rendering.include_name|upper}}_ARGS_OPCODE_WORDS - 1; i >= 0; i--) {
+    if (a[i] != b[i]) {
+      return (a[i] < b[i]) ? -1 : 1;
+    }
+  }
+  return 0;
+}
+{%- endif %}
+
+enum {
+  COMMAND_COUNT = sizeof(Commands) / sizeof(Commands[0]),
+};
+
+/**
+ * Finds the command with exactly this opcode, and copies it to found.
+ *
+ * Returns false if the opcode is not a command.
+ */
+{% if rendering.opcode_words == 1 -%}
+static bool findCommand({{rendering.module_prefix}}Opcode opcode, Command *found) {
+  {{commandIndexType}} low = 0;
+  {{commandIndexType}} high = COMMAND_COUNT;
+
+  while (low < high) {
+    {{commandIndexType}} mid = low + (high - low) / 2;
+    ROM_COPY(*found, Commands[mid]);
+    if (found->opcode < opcode) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  if (low < COMMAND_COUNT) {
+    ROM_COPY(*found, Commands[low]);
+    return found->opcode == opcode;
+  }
+  return false;
+}
+{%- else -%}
+static bool findCommand({{rendering.module_prefix}}OpcodeWord const *opcode, Command *found) {
+  {{commandIndexType}} low = 0;
+  {{commandIndexType}} high = COMMAND_COUNT;
+
+  while (low < high) {
+    {{commandIndexType}} mid = low + (high - low) / 2;
+    ROM_COPY(*found, Commands[mid]);
+    if (compareOpcodes(found->opcode, opcode) < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  if (low < COMMAND_COUNT) {
+    ROM_COPY(*found, Commands[low]);
+    return compareOpcodes(found->opcode, opcode) == 0;
+  }
+  return false;
+}
+{%- endif %}
 
-  if (errNo != DOCOPT_NO_ERROR) {
-    return {{rendering.module_prefix}}_handle_Error(&docoptArgs);
+{% endif -%}
+/**
+ * Calls the handler for the command in the parsed arguments (or the error or
+ * help handler).
+ */
+static char const *{{"runCommand" if rendering.instrument else "dispatchArgs"}}({{rendering.module_prefix}}Context *ctx) {
+  {{rendering.module_prefix}}Args *args = &ctx->args;
+  if (args->error != DOCOPT_NO_ERROR) {
+    return {{rendering.module_prefix}}_handle_Error(args);
   }
 
-  switch (docoptArgs.opcode) {
+  {% if rendering.dispatch == "table" -%}
+  Command command;
+  if (findCommand(args->opcode, &command)) {
+    return runHandler(ctx, command.index, command.handler);
+  }
+  {%- else -%}
+  switch (args->opcode) {
     // AUTOGEN CASES FOR COMMAND COMBINATIONS - START
     {% for command in rendering.commands -%}
     case CMD{{command.parts|length}}({{command.parts|escape_c_keywords|join(", ")}}):
-      return {{rendering.module_prefix}}_handle_{{command.function_name}}(&docoptArgs);
+      return runHandler(ctx, {{loop.index0}}, {{handler(command)}});
     {% endfor -%}
     // AUTOGEN CASES FOR COMMAND COMBINATIONS - END
     default:
       break;
   }
-  if (docoptArgs.help) {
-    return {{rendering.module_prefix}}_handle_Help(&docoptArgs);
+  {%- endif %}
+  if (args->help) {
+    return {{rendering.module_prefix}}_handle_Help(args);
   }
   return "Unknown command";
 }
+{%- if rendering.instrument %}
 
-char const *{{rendering.module_prefix}}_getPrompt(void) {
-  return "{{rendering.prompt}} ";
+/**
+ * Runs the command, timing it and counting its error (if it has one).
+{%- if rendering.resumable %}
+ *
+ * NB: The error of a resumable command is counted once it is done (or
+ *     cancelled), rather than for each slice.
+{%- endif %}
+ */
+static char const *dispatchArgs({{rendering.module_prefix}}Context *ctx) {
+  TIMING_START(timingStart);
+  char const *result = runCommand(ctx);
+  TIMING_END(ctx, dispatch, timingStart);
+  {%- if rendering.resumable %}
+  if ((result != {{rendering.include_name|upper}}_PENDING) || ctx->args.cancel) {
+    COUNT_ERROR(ctx, ctx->args.error);
+  }
+  {%- else %}
+  COUNT_ERROR(ctx, ctx->args.error);
+  {%- endif %}
+  return result;
 }
+{%- endif %}
 
-char const *{{rendering.module_prefix}}_getHelpText(void) {
-  return "{{rendering.help}}";
+{% set context = rendering.module_prefix + "Context" -%}
+{% set pending = rendering.include_name|upper + "_PENDING" -%}
+{% if not rendering.multithreaded -%}
+static {{context}} sharedContext; // Shared between the calls without one
+
+{% endif -%}
+static char const *processArgs({{context}} *ctx, uint8_t argc, bool unescape)
+{
+  {% if rendering.instrument -%}
+  TIMING_START(timingStart);
+  ctx->args.error = parseArgs(&ctx->args, ctx->argv, argc, unescape);
+  TIMING_END(ctx, parse, timingStart);
+  {%- else -%}
+  ctx->args.error = parseArgs(&ctx->args, ctx->argv, argc, unescape);
+  {%- endif %}
+  {% if rendering.resumable -%}
+  char const *result = dispatchArgs(ctx);
+  ctx->pending = (result == {{pending}});
+  return result;
+  {%- else -%}
+  return dispatchArgs(ctx);
+  {%- endif %}
+}
+
+{% if rendering.streaming -%}
+{% set stream = rendering.module_prefix + "Stream" -%}
+#define HELP_TOKEN (-2)
+
+static bool isSpace(char c) { return (c == ' ') || (c == '\t'); }
+
+void {{rendering.module_prefix}}_streamReset({{stream}} *stream) {
+  memset(stream, 0, sizeof(*stream));
+}
+
+/**
+ * Finishes the token being typed, and enters its command word into the opcode
+ * (the same as parseArgs() would).
+ */
+static void endToken({{stream}} *stream, char const *line) {
+  stream->inToken = false;
+  if (stream->count >= {{rendering.include_name|upper}}_ARGS_TOKENS_MAX) {
+    stream->tooManyTokens = true;
+    return;
+  }
+
+  uint8_t i = stream->count++;
+  uint8_t length = stream->length - stream->start;
+  char const *text = &line[stream->start];
+  stream->slices[i].offset = stream->start;
+  stream->slices[i].length = length;
+
+  {{tokenType}} token = NO_TOKEN;
+  if ((length == 1) && (text[0] == '?')) {
+    token = HELP_TOKEN;
+    stream->helpCount++;
+    stream->consumed |= TOKEN_BIT(i);
+  } else if (text[0] != '-') {
+    {% if rendering.matcher == "trie" -%}
+    token = stream->matching
+                ? {{tokenType|rom_read}}(&TokenTrieMatch[stream->node])
+                : NO_TOKEN;
+    {%- else -%}
+    token = matchToken(text, length);
+    {%- endif %}
+    if ((token != NO_TOKEN) && !OPCODE_TEST(stream->opcode, token)) {
+      OPCODE_SET(stream->opcode, token);
+      stream->consumed |= TOKEN_BIT(i);
+    }
+  }
+  stream->matched[i] = token;
+}
+
+/**
+ * Takes the last token back out (e.g. when it has been edited).
+ */
+static void popToken({{stream}} *stream) {
+  uint8_t i = --stream->count;
+  if ((stream->consumed & TOKEN_BIT(i)) != 0) {
+    if (stream->matched[i] == HELP_TOKEN) {
+      stream->helpCount--;
+    } else {
+      OPCODE_CLEAR(stream->opcode, stream->matched[i]);
+    }
+    stream->consumed &= ~TOKEN_BIT(i);
+  }
+}
+
+/**
+ * Moves the tokenizer (the same rules as Docopt_tokenize()) and the matcher
+ * on by the next character of the line.
+ */
+static void streamChar({{stream}} *stream, char const *line) {
+  char c = line[stream->length];
+
+  if (!stream->inToken) {
+    if (isSpace(c)) {
+      stream->length++;
+      return;
+    }
+    stream->inToken = true;
+    stream->start = stream->length;
+    stream->quote = '\0';
+    stream->escaped = false;
+    {% if rendering.matcher == "trie" -%}
+    stream->node = 0;
+    stream->matching = true;
+    {% endif -%}
+  } else if (!stream->escaped && (stream->quote == '\0') && isSpace(c)) {
+    endToken(stream, line);
+    stream->length++;
+    return;
+  }
+
+  if (stream->escaped) {
+    stream->escaped = false;
+  } else if (stream->quote == '\'') {
+    if (c == '\'') {
+      stream->quote = '\0';
+    }
+  } else if (c == '\\') {
+    stream->escaped = true;
+  } else if (stream->quote == '"') {
+    if (c == '"') {
+      stream->quote = '\0';
+    }
+  } else if ((c == '"') || (c == '\'')) {
+    stream->quote = c;
+  }
+  {%- if rendering.matcher == "trie" %}
+
+  if (stream->matching) {
+    stream->matching = stepToken(&stream->node, c);
+  }
+  {%- endif %}
+  stream->length++;
+}
+
+void {{rendering.module_prefix}}_streamUpdate({{stream}} *stream, char const *line, uint8_t length, uint8_t changedFrom) {
+  if (changedFrom > length) {
+    changedFrom = length;
+  }
+
+  if (changedFrom < stream->length) {
+    if (stream->tooManyTokens) {
+      {{rendering.module_prefix}}_streamReset(stream);
+    } else {
+      // i.e. go back to the end of the last token that hasn't changed (or
+      // had the space after it changed)
+      while ((stream->count > 0) &&
+             (stream->slices[stream->count - 1].offset +
+                  stream->slices[stream->count - 1].length >=
+              changedFrom)) {
+        popToken(stream);
+      }
+      stream->inToken = false;
+      stream->length = 0;
+      if (stream->count > 0) {
+        stream->length = stream->slices[stream->count - 1].offset +
+                         stream->slices[stream->count - 1].length;
+      }
+    }
+  }
+
+  while (stream->length < length) {
+    streamChar(stream, line);
+  }
+}
+
+char const *{{rendering.module_prefix}}_streamEndCtx({{context}} *ctx, {{stream}} *stream, char const *line, uint8_t length) {
+  {{rendering.module_prefix}}Args *args = &ctx->args;
+  {% if rendering.instrument -%}
+  TIMING_START(timingStart); // i.e. what is left of the parsing
+  {% endif -%}
+  {{rendering.module_prefix}}_streamUpdate(stream, line, length, length);
+  bool unterminated = stream->inToken && (stream->quote != '\0');
+  if (stream->inToken) {
+    endToken(stream, line);
+  }
+
+  memset(args, 0, sizeof({{rendering.module_prefix}}Args));
+  if (stream->tooManyTokens) {
+    args->error = DOCOPT_ERROR_TOO_MANY_TOKENS;
+  } else if (unterminated) {
+    args->error = DOCOPT_ERROR_UNTERMINATED_QUOTE;
+  } else {
+    for (int i = 0; i < stream->count; i++) {
+      ctx->argv[i].text = &line[stream->slices[i].offset];
+      ctx->argv[i].length = stream->slices[i].length;
+    }
+    memcpy(&args->opcode, &stream->opcode, sizeof(args->opcode));
+    args->help = (stream->helpCount > 0);
+    args->error = collectArgs(args, ctx->argv, stream->count,
+                              stream->consumed, true);
+  }
+
+  {{rendering.module_prefix}}_streamReset(stream);
+  {% if rendering.instrument -%}
+  TIMING_END(ctx, parse, timingStart);
+  {% endif -%}
+  {% if rendering.resumable -%}
+  char const *result = dispatchArgs(ctx);
+  ctx->pending = (result == {{pending}});
+  return result;
+  {%- else -%}
+  return dispatchArgs(ctx);
+  {%- endif %}
+}
+
+char const *{{rendering.module_prefix}}_streamEnd({{stream}} *stream, char const *line, uint8_t length) {
+  {%- if rendering.multithreaded %}
+  {{context}} ctx; // Lives on the stack
+  {%- if rendering.instrument %}
+  CLEAR_STATS(&ctx);
+  {%- endif %}
+  return {{rendering.module_prefix}}_streamEndCtx(&ctx, stream, line, length);
+  {%- else %}
+  return {{rendering.module_prefix}}_streamEndCtx(&sharedContext, stream, line, length);
+  {%- endif %}
+}
+
+{% endif -%}
+char const *{{rendering.module_prefix}}_processLineCtx({{context}} *ctx, char const *line, DocoptSlice const *slices, uint8_t count) {
+  for (int i = 0; (i < count) && (i < {{rendering.include_name|upper}}_ARGS_TOKENS_MAX); i++) {
+    ctx->argv[i].text = &line[slices[i].offset];
+    ctx->argv[i].length = slices[i].length;
+  }
+  return processArgs(ctx, count, true);
+}
+
+char const *{{rendering.module_prefix}}_processCommandCtx({{context}} *ctx, uint8_t argc, char **argv) {
+  for (int i = 0; (i < argc) && (i < {{rendering.include_name|upper}}_ARGS_TOKENS_MAX); i++) {
+    size_t length = strlen(argv[i]);
+    if (length > UINT8_MAX) {
+      // i.e. a token can't hold its length, so it would be parsed cut short
+      memset(&ctx->args, 0, sizeof({{rendering.module_prefix}}Args));
+      ctx->args.error = DOCOPT_ERROR_TOO_LONG;
+      {%- if rendering.resumable %}
+      ctx->pending = false;
+      {%- endif %}
+      return dispatchArgs(ctx);
+    }
+    ctx->argv[i].text = argv[i];
+    ctx->argv[i].length = (uint8_t)length;
+  }
+  return processArgs(ctx, argc, false);
+}
+
+char const *{{rendering.module_prefix}}_processLine(char const *line, DocoptSlice const *slices, uint8_t count) {
+  {%- if rendering.multithreaded %}
+  {{context}} ctx; // Lives on the stack
+  {%- if rendering.instrument %}
+  CLEAR_STATS(&ctx);
+  {%- endif %}
+  return {{rendering.module_prefix}}_processLineCtx(&ctx, line, slices, count);
+  {%- else %}
+  return {{rendering.module_prefix}}_processLineCtx(&sharedContext, line, slices, count);
+  {%- endif %}
+}
+
+char const *{{rendering.module_prefix}}_processCommand(uint8_t argc, char **argv) {
+  {%- if rendering.multithreaded %}
+  {{context}} ctx; // Lives on the stack
+  {%- if rendering.instrument %}
+  CLEAR_STATS(&ctx);
+  {%- endif %}
+  return {{rendering.module_prefix}}_processCommandCtx(&ctx, argc, argv);
+  {%- else %}
+  return {{rendering.module_prefix}}_processCommandCtx(&sharedContext, argc, argv);
+  {%- endif %}
+}
+
+{% if rendering.binary -%}
+typedef struct {
+  uint16_t id;
+{%- if rendering.opcode_words == 1 %}
+  {{rendering.module_prefix}}Opcode opcode;
+{%- else %}
+  {{rendering.module_prefix}}OpcodeWord opcode[{{rendering.include_name|upper}}_ARGS_OPCODE_WORDS];
+{%- endif %}
+} BinaryCommand;
+
+// Sorted by ID, for the binary search in findBinaryCommand()
+static const BinaryCommand BinaryCommands[] ROM = {
+  {%- for id, command in rendering.binary_commands %}
+  {%- if rendering.opcode_words == 1 %}
+  { {{rendering.binary_command_enum(command)}}, CMD{{command.parts|length}}({{command.parts|escape_c_keywords|join(", ")}}) },
+  {%- else %}
+  { {{rendering.binary_command_enum(command)}}, { {% for word in rendering.opcode_word_values(command) %}{{"0x%08xu"|format(word)}}{{", " if not loop.last}}{% endfor %} } },
+  {%- endif %}
+  {%- endfor %}
+};
+
+typedef struct {
+  uint16_t id;
+  {{optionType}} option;
+} BinaryOption;
+
+// Sorted by ID, for the search in findBinaryOption()
+static const BinaryOption BinaryOptions[] ROM = {
+  {%- for id, name, value in rendering.binary_options %}
+  { {{rendering.binary_option_enum(name)}}, {{value}} },
+  {%- endfor %}
+};
+
+// Copies the command with this ID to found, or returns false if there is none
+static bool findBinaryCommand(uint16_t id, BinaryCommand *found) {
+  {{commandIndexType}} low = 0;
+  {{commandIndexType}} high = sizeof(BinaryCommands) / sizeof(BinaryCommands[0]);
+
+  while (low < high) {
+    {{commandIndexType}} mid = low + (high - low) / 2;
+    if (ROM_WORD(&BinaryCommands[mid].id) < id) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  if ((low < sizeof(BinaryCommands) / sizeof(BinaryCommands[0])) &&
+      (ROM_WORD(&BinaryCommands[low].id) == id)) {
+    ROM_COPY(*found, BinaryCommands[low]);
+    return true;
+  }
+  return false;
+}
+
+// NB: There are only a few options, so they are looked through in order
+static {{optionType}} findBinaryOption(uint16_t id) {
+  for (uint8_t i = 0; i < sizeof(BinaryOptions) / sizeof(BinaryOptions[0]); i++) {
+    if (ROM_WORD(&BinaryOptions[i].id) == id) {
+      return {{optionType|rom_read}}(&BinaryOptions[i].option);
+    }
+  }
+  return NO_OPTION;
+}
+
+static uint16_t readUint16(uint8_t const *bytes) {
+  return (uint16_t)(bytes[0] | (bytes[1] << 8));
+}
+
+enum {
+  INT_TEXT_MAX = 11, // i.e. "-2147483648"
+};
+
+/**
+ * Writes a (little endian) int32_t of a frame as decimal text at the end of
+ * digits, which is how the handlers take it.
+ *
+ * Returns where the text starts, and its length in *length.
+ */
+static char const *formatInt(uint8_t const *bytes, char digits[INT_TEXT_MAX],
+                             uint8_t *length) {
+  uint32_t value = (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) |
+                   ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+  bool negative = (value & 0x80000000u) != 0;
+  uint32_t magnitude = negative ? (0u - value) : value;
+  uint8_t at = INT_TEXT_MAX;
+  do {
+    digits[--at] = (char)('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude > 0);
+  if (negative) {
+    digits[--at] = '-';
+  }
+  *length = INT_TEXT_MAX - at;
+  return &digits[at];
+}
+
+/**
+ * Parses a frame (see docopt_tokenize.h) into the args, as parseArgs() does
+ * a line: the opcode is that of the command ID (or 0 for an unknown one),
+ * and the values are copied into args->text.
+ */
+static enum DocoptError decodeFrame({{rendering.module_prefix}}Args *args, uint8_t const *frame,
+                                    uint8_t length) {
+  memset(args, 0, sizeof({{rendering.module_prefix}}Args));
+
+  // i.e. the length, the command ID and the CRC
+  if ((length < 5) || (frame[0] != length - 3) ||
+      (Docopt_crc16(DOCOPT_CRC16_INIT, frame, length - 2) !=
+       readUint16(&frame[length - 2]))) {
+    return DOCOPT_ERROR_BAD_FRAME;
+  }
+  BinaryCommand command;
+  if (findBinaryCommand(readUint16(&frame[1]), &command)) {
+    memcpy(&args->opcode, &command.opcode, sizeof(args->opcode));
+  }
+
+  uint8_t end = length - 2;
+  for (uint8_t i = 3; i < end;) {
+    uint8_t kind = frame[i++];
+    {{optionType}} option = NO_OPTION;
+    if ((kind & ~DOCOPT_BINARY_INT) == DOCOPT_BINARY_OPTION) {
+      if (end - i < 2) {
+        return DOCOPT_ERROR_BAD_FRAME;
+      }
+      option = findBinaryOption(readUint16(&frame[i]));
+      i += 2;
+      if (option == NO_OPTION) {
+        return DOCOPT_ERROR_UNKNOWN_OPTION;
+      }
+    } else if ((kind & ~DOCOPT_BINARY_INT) != DOCOPT_BINARY_POSITIONAL) {
+      return DOCOPT_ERROR_BAD_FRAME;
+    }
+    if ((i >= end) || (frame[i] > end - i - 1)) {
+      return DOCOPT_ERROR_BAD_FRAME;
+    }
+    uint8_t valueLength = frame[i++];
+    char const *value = (char const *)&frame[i];
+    i += valueLength;
+
+    char digits[INT_TEXT_MAX];
+    if ((kind & DOCOPT_BINARY_INT) != 0) {
+      if (valueLength != 4) {
+        return DOCOPT_ERROR_BAD_FRAME;
+      }
+      value = formatInt((uint8_t const *)value, digits, &valueLength);
+    }
+
+    enum DocoptError err = DOCOPT_NO_ERROR;
+    if (option != NO_OPTION) {
+      // i.e. a flag is given without a value
+      bool flag = (valueLength == 0) && !takesValue(option);
+      err = setOption(args, option, flag ? NULL : value, valueLength, false);
+    } else {
+      {%- if rendering.positional_max %}
+      if (args->posCount >= {{rendering.include_name|upper}}_ARGS_POSITIONAL_ARGS_MAX) {
+        return DOCOPT_ERROR_TOO_MANY_POSITIONAL;
+      }
+      char *saved = saveText(args, value, valueLength, false);
+      if (saved == NULL) {
+        return DOCOPT_ERROR_TOO_LONG;
+      }
+      args->posValue[args->posCount++] = saved;
+      {%- else %}
+      err = DOCOPT_ERROR_TOO_MANY_POSITIONAL;
+      {%- endif %}
+    }
+    if (err != DOCOPT_NO_ERROR) {
+      return err;
+    }
+  }
+  return DOCOPT_NO_ERROR;
+}
+
+char const *{{rendering.module_prefix}}_processFrameCtx({{context}} *ctx, uint8_t const *frame, uint8_t length) {
+  {% if rendering.instrument -%}
+  TIMING_START(timingStart);
+  ctx->args.error = decodeFrame(&ctx->args, frame, length);
+  TIMING_END(ctx, parse, timingStart);
+  {%- else -%}
+  ctx->args.error = decodeFrame(&ctx->args, frame, length);
+  {%- endif %}
+  {% if rendering.resumable -%}
+  char const *result = dispatchArgs(ctx);
+  ctx->pending = (result == {{pending}});
+  return result;
+  {%- else -%}
+  return dispatchArgs(ctx);
+  {%- endif %}
+}
+
+char const *{{rendering.module_prefix}}_processFrame(uint8_t const *frame, uint8_t length) {
+  {%- if rendering.multithreaded %}
+  {{context}} ctx; // Lives on the stack
+  {%- if rendering.instrument %}
+  CLEAR_STATS(&ctx);
+  {%- endif %}
+  return {{rendering.module_prefix}}_processFrameCtx(&ctx, frame, length);
+  {%- else %}
+  return {{rendering.module_prefix}}_processFrameCtx(&sharedContext, frame, length);
+  {%- endif %}
+}
+
+{% endif -%}
+{% if rendering.resumable -%}
+char const {{rendering.module_prefix}}_pending[] = "Pending";
+
+/*
+ * NB: The handler is found (and its arguments checked) again for each slice,
+ *     from the arguments kept in the context, which costs little next to the
+ *     slice itself.
+ */
+char const *{{rendering.module_prefix}}_resumeCtx({{context}} *ctx) {
+  if (!ctx->pending) {
+    return NULL;
+  }
+  {%- if rendering.instrument %}
+  RESUMING(ctx, true);
+  char const *result = dispatchArgs(ctx);
+  RESUMING(ctx, false);
+  {%- else %}
+  char const *result = dispatchArgs(ctx);
+  {%- endif %}
+  ctx->pending = (result == {{pending}});
+  return result;
+}
+
+char const *{{rendering.module_prefix}}_cancelCtx({{context}} *ctx) {
+  if (!ctx->pending) {
+    return NULL;
+  }
+  ctx->pending = false;
+  ctx->args.cancel = true;
+  {%- if rendering.instrument %}
+  RESUMING(ctx, true);
+  char const *result = dispatchArgs(ctx);
+  RESUMING(ctx, false);
+  {%- else %}
+  char const *result = dispatchArgs(ctx);
+  {%- endif %}
+  // i.e. a cancelled command is done, whatever it says
+  return (result == {{pending}}) ? NULL : result;
+}
+{%- if not rendering.multithreaded %}
+
+char const *{{rendering.module_prefix}}_resume(void) {
+  return {{rendering.module_prefix}}_resumeCtx(&sharedContext);
+}
+
+char const *{{rendering.module_prefix}}_cancel(void) {
+  return {{rendering.module_prefix}}_cancelCtx(&sharedContext);
+}
+{%- endif %}
+
+{% endif -%}
+
+{% if rendering.completion -%}
+{# Adds the names (of a matcher) that start with the name so far, and that
+    are accepted (with end after them if there is only one) -#}
+{% macro completer(kind, params, accept, end, skip) -%}
+{% set resultType = tokenType if kind == "Token" else optionType -%}
+{% if rendering.matcher == "trie" -%}
+{% set trieType = (rendering.token_trie if kind == "Token" else rendering.option_trie).tokens|length|c_uint_type -%}
+{% set noMatch = "NO_TOKEN" if kind == "Token" else "NO_OPTION" -%}
+/**
+ * Adds the names below this node of the {{kind|lower}} trie, the first length
+ * characters of which are already in the completions' name.
+ */
+static void complete{{kind}}s(Completions *completions, {{trieType}} node,
+{{" " * (kind|length + 22)}}uint8_t length{{params}}) {
+  {{resultType}} match = {{resultType|rom_read}}(&{{kind}}TrieMatch[node]);
+  {{trieType}} first = {{trieType|rom_read}}(&{{kind}}TrieFirstEdge[node]);
+  {{trieType}} end = {{trieType|rom_read}}(&{{kind}}TrieFirstEdge[node + 1]);
+  {%- if rendering.abbreviations %}
+
+  // i.e. rather than the start of the only name below it
+  for ({{trieType}} edge = first; edge < end; edge++) {
+    {{trieType}} next = {{trieType|rom_read}}(&{{kind}}TrieEdges[edge].next);
+    if ({{resultType|rom_read}}(&{{kind}}TrieMatch[next]) == match) {
+      match = {{noMatch}};
+    }
+  }
+  {%- endif %}
+
+  if ({{"(match != %s) && %s"|format(noMatch, accept) if accept else "match != " + noMatch}}) {
+    addCompletion(completions, length, {{end}});
+  }
+  for ({{trieType}} edge = first; edge < end; edge++) {
+    completions->name[length] = (char)ROM_BYTE(&{{kind}}TrieEdges[edge].c);
+    complete{{kind}}s(completions,
+                   {{trieType|rom_read}}(&{{kind}}TrieEdges[edge].next), length + 1
+                   {{- ", allowed" if kind == "Token"}});
+  }
+}
+{%- else -%}
+/**
+ * Adds the {{kind|lower}} names that start with the first length characters
+ * of the completions' name.
+ */
+static void complete{{kind}}s(Completions *completions,
+{{" " * (kind|length + 22)}}uint8_t length{{params}}) {
+  for (int j = 0; j < {{(rendering.tokens if kind == "Token" else rendering.option_names)|length}}; j++) {
+    uint16_t offset = ROM_WORD(&{{kind}}NameOffsets[j]);
+    uint8_t nameLength = ROM_BYTE(&{{kind}}NameLengths[j]){{" + %d"|format(skip) if skip}};
+    {{resultType}} match = {{resultType|rom_read}}(&{{kind}}Values[j]);
+    if ((nameLength < length) ||
+        !startsWith(offset, &completions->name[{{skip}}], length{{" - %d"|format(skip) if skip}})
+        {%- if accept %} ||
+        !{{accept}}
+        {%- endif %}) {
+      continue;
+    }
+    for (uint8_t i = length; i < nameLength; i++) {
+      completions->name[i] = ROM_BYTE(&Strings[offset + i{{" - %d"|format(skip) if skip}}]);
+    }
+    addCompletion(completions, nameLength, {{end}});
+  }
+}
+{%- endif %}
+{%- endmacro -%}
+
+enum {
+  COMPLETION_MAX = {{rendering.completion_max}},
+  TOKEN_MASK_BITS = {{rendering.opcode_bits}},
+};
+
+// i.e. a bit for each command token
+typedef {{rendering.opcode_type}} TokenMask[{{rendering.opcode_words}}];
+
+// The tokens that are in a command with each token
+static const TokenMask TokenFollows[] ROM = {
+  // AUTOGEN TOKEN FOLLOWS - START
+  {% for words in rendering.token_follows -%}
+  { {% for word in words %}{{"0x%x"|format(word)}}{{", " if not loop.last}}{% endfor %} }, // {{rendering.tokens[loop.index0]}}
+  {% endfor -%}
+  // AUTOGEN TOKEN FOLLOWS - END
+};
+
+typedef struct {
+  DocoptWriteFunc list; // i.e. NULL unless they are being listed
+  uint8_t prefixLength; // i.e. of the last word, as far as it was typed
+  uint8_t count;
+  uint8_t commonLength;
+  char common[COMPLETION_MAX]; // i.e. what all of them start with so far
+  char name[COMPLETION_MAX];   // i.e. the one being looked at
+} Completions;
+
+/**
+ * Adds the completion in the name, which is followed by end if it turns out
+ * to be the only one.
+ */
+static void addCompletion(Completions *completions, uint8_t length, char end) {
+  if (completions->list != NULL) {
+    completions->list(completions->name, length);
+    completions->list("  ", 2);
+  }
+  if (completions->count == 0) {
+    memcpy(completions->common, completions->name, length);
+    completions->common[length] = end;
+    completions->commonLength = length + 1;
+  } else {
+    uint8_t i = 0;
+    while ((i < completions->commonLength) && (i < length) &&
+           (completions->common[i] == completions->name[i])) {
+      i++;
+    }
+    completions->commonLength = i;
+  }
+  completions->count++;
+}
+
+static bool hasToken(TokenMask const mask, {{tokenType}} token) {
+  return ((mask[token / TOKEN_MASK_BITS] >> (token % TOKEN_MASK_BITS)) & 1) != 0;
+}
+
+{{ completer("Token", ", TokenMask const allowed", "hasToken(allowed, match)", "' '", 0) }}
+
+{{ completer("Option", "", "", "(takesValue(match) ? '=' : ' ')", 2) }}
+
+/**
+ * Finds what could finish the last word of the line, i.e. the command words
+ * that are in a command with all of the command words before it, or the
+ * long options if it starts with "--".
+ *
+ * NB: The tokens that can go with each command word are worked out by the
+ *     generator, so this costs the same however many commands there are.
+ */
+static void findCompletions(char const *line, uint8_t length,
+                            Completions *completions) {
+  // i.e. the last word is whatever follows the last space (if anything)
+  uint8_t start = length;
+  while ((start > 0) && (line[start - 1] != ' ')) {
+    start--;
+  }
+  char const *prefix = &line[start];
+  uint8_t prefixLength = length - start;
+  if (prefixLength >= COMPLETION_MAX) {
+    return;
+  }
+  memcpy(completions->name, prefix, prefixLength);
+  completions->prefixLength = prefixLength;
+  {%- if rendering.matcher == "trie" %}
+  {%- set optionTrieType = rendering.option_trie.tokens|length|c_uint_type %}
+  {%- set tokenTrieType = rendering.token_trie.tokens|length|c_uint_type %}
+
+  if ((prefixLength >= 2) && (prefix[0] == '-') && (prefix[1] == '-')) {
+    {{optionTrieType}} node = 0;
+    for (uint8_t i = 2; i < prefixLength; i++) {
+      if (!stepOption(&node, prefix[i])) {
+        return;
+      }
+    }
+    completeOptions(completions, node, prefixLength);
+    return;
+  }
+  {%- else %}
+
+  if ((prefixLength >= 2) && (prefix[0] == '-') && (prefix[1] == '-')) {
+    completeOptions(completions, prefixLength);
+    return;
+  }
+  {%- endif %}
+
+  DocoptSlice slices[{{rendering.include_name|upper}}_ARGS_TOKENS_MAX];
+  uint8_t count;
+  if (Docopt_tokenize(line, start, slices, {{rendering.include_name|upper}}_ARGS_TOKENS_MAX, &count) !=
+      DOCOPT_NO_ERROR) {
+    return;
+  }
+  TokenMask allowed;
+  memset(allowed, 0xFF, sizeof(allowed));
+  for (uint8_t i = 0; i < count; i++) {
+    {{tokenType}} token = matchToken(&line[slices[i].offset], slices[i].length);
+    if (token == NO_TOKEN) {
+      continue; // i.e. an argument
+    }
+    for (uint8_t w = 0; w < {{rendering.opcode_words}}; w++) {
+      {{rendering.opcode_type}} follows;
+      ROM_COPY(follows, TokenFollows[token][w]);
+      allowed[w] &= follows;
+    }
+    // i.e. but not the same word again
+    allowed[token / TOKEN_MASK_BITS] &=
+        ~(({{rendering.opcode_type}})1 << (token % TOKEN_MASK_BITS));
+  }
+  {%- if rendering.matcher == "trie" %}
+
+  {{tokenTrieType}} node = 0;
+  for (uint8_t i = 0; i < prefixLength; i++) {
+    if (!stepToken(&node, prefix[i])) {
+      return;
+    }
+  }
+  completeTokens(completions, node, prefixLength, allowed);
+  {%- else %}
+  completeTokens(completions, prefixLength, allowed);
+  {%- endif %}
+}
+
+uint8_t {{rendering.module_prefix}}_complete(char const *line, uint8_t length,
+{{" " * (rendering.module_prefix|length + 18)}}char *completion, uint8_t size) {
+  Completions completions = {NULL, 0, 0, 0, {0}, {0}};
+  findCompletions(line, length, &completions);
+  if (completions.count == 0) {
+    return 0;
+  }
+  uint8_t added = completions.commonLength - completions.prefixLength;
+  if (added > size) {
+    added = size;
+  }
+  memcpy(completion, &completions.common[completions.prefixLength], added);
+  return added;
+}
+
+void {{rendering.module_prefix}}_listCompletions(char const *line, uint8_t length,
+{{" " * (rendering.module_prefix|length + 22)}}DocoptWriteFunc write) {
+  Completions completions = {write, 0, 0, 0, {0}, {0}};
+  findCompletions(line, length, &completions);
+}
+
+{% endif -%}
+char const *{{rendering.module_prefix}}_getPrompt(void) {
+  return "{{rendering.prompt}} ";
+}
+
+{% if not rendering.compress_help -%}
+char const *{{rendering.module_prefix}}_getHelpText(void) {
+  return Strings;
+}
+
+{% endif -%}
+{% set helpLineType = (rendering.help_line_offsets|length)|c_uint_type -%}
+enum {
+  HELP_LINE_COUNT = {{rendering.help_line_offsets|length - 1}},
+};
+
+/*
+ * The help text is written a chunk at a time, as it is read from the ROM
+ * (and decompressed).
+ */
+typedef struct {
+  DocoptWriteFunc write;
+  uint8_t length;
+  char text[16];
+} HelpChunk;
+
+static void writeHelpChar(HelpChunk *chunk, char c) {
+  chunk->text[chunk->length++] = c;
+  if (chunk->length == sizeof(chunk->text)) {
+    chunk->write(chunk->text, chunk->length);
+    chunk->length = 0;
+  }
+}
+
+/**
+ * Writes the lines of the help text from first up to (but not including)
+ * end.
+ */
+static void writeHelpLines(DocoptWriteFunc write, {{helpLineType}} first,
+                           {{helpLineType}} end) {
+  HelpChunk chunk = {write, 0, {0}};
+  uint16_t stop = ROM_WORD(&HelpLines[end]);
+
+  for (uint16_t i = ROM_WORD(&HelpLines[first]); i < stop; i++) {
+    char c = ROM_BYTE(&{{help}}[i]);
+    {%- if rendering.compress_help %}
+    if ((uint8_t)c >= HELP_WORD_CODE) {
+      uint8_t word = (uint8_t)c - HELP_WORD_CODE;
+      uint16_t offset = ROM_WORD(&HelpWordOffsets[word]);
+      uint8_t length = ROM_BYTE(&HelpWordLengths[word]);
+      for (uint8_t j = 0; j < length; j++) {
+        writeHelpChar(&chunk, ROM_BYTE(&Strings[offset + j]));
+      }
+      continue;
+    }
+    {%- endif %}
+    writeHelpChar(&chunk, c);
+  }
+  if (chunk.length > 0) {
+    write(chunk.text, chunk.length);
+  }
+}
+
+void {{rendering.module_prefix}}_writeHelp(DocoptWriteFunc write) {
+  writeHelpLines(write, 0, HELP_LINE_COUNT);
+}
+{% if rendering.help_usage_line is not none %}
+
+{% set optionMaskType = rendering.option_mask_type -%}
+{% set helpOptions = rendering.options and rendering.help_options_line is not none -%}
+typedef struct {
+  {% if rendering.opcode_words == 1 -%}
+  {{rendering.module_prefix}}Opcode opcode;
+  {%- else -%}
+  {{rendering.module_prefix}}OpcodeWord opcode[{{rendering.include_name|upper}}_ARGS_OPCODE_WORDS];
+  {%- endif %}
+  {{helpLineType}} usageLine;
+  {% if helpOptions -%}
+  {{optionMaskType}} options; // i.e. those with lines in "Options:"
+  {% endif -%}
+} CommandHelp;
+
+// The usage line of each command, and the options it takes
+static const CommandHelp CommandHelps[] ROM = {
+  // AUTOGEN COMMAND HELP - START
+  {% for command in rendering.help_commands -%}
+  {% if rendering.opcode_words == 1 -%}
+  { CMD{{command.parts|length}}({{command.parts|escape_c_keywords|join(", ")}})
+  {%- else -%}
+  // > {{command.parts|join(" ")}}
+  { { {% for word in rendering.opcode_word_values(command) %}{{"0x%08xu"|format(word)}}{{", " if not loop.last}}{% endfor %} }
+  {%- endif -%}
+  , {{rendering.command_help_line(command)}}
+  {%- if helpOptions -%}
+  , {{"0x%x"|format(rendering.command_help_options(command))}}
+  {%- endif %} },
+  {% endfor -%}
+  // AUTOGEN COMMAND HELP - END
+};
+
+{% if helpOptions -%}
+// The lines of each option in "Options:" (from first up to end)
+static const {{helpLineType}} OptionHelpLines[][2] ROM = {
+  // AUTOGEN OPTION HELP - START
+  {% for first, end in rendering.option_help -%}
+  { {{first}}, {{end}} }, // {{rendering.options[loop.index0].name}}
+  {% endfor -%}
+  // AUTOGEN OPTION HELP - END
+};
+
+{% endif -%}
+enum {
+  HELP_USAGE_LINE = {{rendering.help_usage_line}},
+  {% if rendering.help_options_line is not none -%}
+  HELP_OPTIONS_LINE = {{rendering.help_options_line}},
+  {% endif -%}
+  COMMAND_HELP_COUNT = sizeof(CommandHelps) / sizeof(CommandHelps[0]),
+};
+
+/**
+ * Whether the command has all of the command words that were given.
+ */
+{% if rendering.opcode_words == 1 -%}
+static bool hasCommandWords(CommandHelp const *help, {{rendering.module_prefix}}Opcode opcode) {
+  return (help->opcode & opcode) == opcode;
+}
+{%- else -%}
+static bool hasCommandWords(CommandHelp const *help,
+                            {{rendering.module_prefix}}OpcodeWord const *opcode) {
+  for (uint8_t i = 0; i < {{rendering.include_name|upper}}_ARGS_OPCODE_WORDS; i++) {
+    if ((help->opcode[i] & opcode[i]) != opcode[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+{%- endif %}
+
+void {{rendering.module_prefix}}_writeCommandHelp({{rendering.module_prefix}}Args const *args,
+{{" " * (rendering.module_prefix|length + 23)}}DocoptWriteFunc write) {
+  {% if rendering.opcode_words == 1 -%}
+  bool any = (args->opcode != 0);
+  {%- else -%}
+  bool any = false;
+  for (uint8_t i = 0; i < {{rendering.include_name|upper}}_ARGS_OPCODE_WORDS; i++) {
+    any = any || (args->opcode[i] != 0);
+  }
+  {%- endif %}
+  bool found = false;
+  {%- if helpOptions %}
+  {{optionMaskType}} options = 0;
+  {%- endif %}
+
+  for (uint8_t i = 0; any && (i < COMMAND_HELP_COUNT); i++) {
+    CommandHelp help;
+    ROM_COPY(help, CommandHelps[i]);
+    if (!hasCommandWords(&help, args->opcode)) {
+      continue;
+    }
+    if (!found) {
+      writeHelpLines(write, HELP_USAGE_LINE, HELP_USAGE_LINE + 1);
+      found = true;
+    }
+    writeHelpLines(write, help.usageLine, help.usageLine + 1);
+    {%- if helpOptions %}
+    options |= help.options;
+    {%- endif %}
+  }
+
+  if (!found) {
+    writeHelpLines(write, 0, HELP_LINE_COUNT);
+  {%- if helpOptions %}
+    return;
+  }
+  if (options != 0) {
+    write("\r\n", 2);
+    writeHelpLines(write, HELP_OPTIONS_LINE, HELP_OPTIONS_LINE + 1);
+    for (uint8_t i = 0; i < {{rendering.include_name|upper}}_OPTION_COUNT; i++) {
+      if ((options & ((({{optionMaskType}})1) << i)) != 0) {
+        writeHelpLines(write, {{helpLineType|rom_read}}(&OptionHelpLines[i][0]),
+                       {{helpLineType|rom_read}}(&OptionHelpLines[i][1]));
+      }
+    }
+  }
+  {%- else %}
+  }
+  {%- endif %}
+}
+{%- endif %}
+{% if rendering.instrument %}
+{% set instrument = rendering.include_name|upper + "_INSTRUMENT" -%}
+{% set timing = rendering.module_prefix + "Timing" -%}
+#if {{instrument}}
+// The name of each command (in the order of the usage lines)
+static char const *const CommandNames[] = {
+  {%- for command in rendering.commands %}
+  "{{command.parts|join(" ")}}",
+  {%- endfor %}
+};
+
+static char const *const ErrorNames[DOCOPT_ERROR_COUNT] = {
+  {%- for error, name in rendering.errors %}
+  [{{error}}] = "{{name}}",
+  {%- endfor %}
+};
+
+{{rendering.module_prefix}}Stats const *{{rendering.module_prefix}}_getStats({{rendering.module_prefix}}Context const *ctx) {
+  return &ctx->stats;
+}
+
+void {{rendering.module_prefix}}_resetStats({{rendering.module_prefix}}Context *ctx) {
+  memset(&ctx->stats, 0, sizeof(ctx->stats));
+}
+
+static void writeStatsText(HelpChunk *chunk, char const *text) {
+  while (*text != '\0') {
+    writeHelpChar(chunk, *text++);
+  }
+}
+
+static void writeStatsNumber(HelpChunk *chunk, uint64_t number) {
+  char digits[20];
+  uint8_t count = 0;
+  do {
+    digits[count++] = (char)('0' + number % 10);
+    number /= 10;
+  } while (number > 0);
+  while (count > 0) {
+    writeHelpChar(chunk, digits[--count]);
+  }
+}
+
+static void writeTiming(HelpChunk *chunk, char const *name,
+                        {{timing}} const *timing) {
+  writeStatsText(chunk, name);
+  writeStatsText(chunk, ": calls ");
+  writeStatsNumber(chunk, timing->calls);
+  writeStatsText(chunk, ", min ");
+  writeStatsNumber(chunk, timing->min);
+  writeStatsText(chunk, ", max ");
+  writeStatsNumber(chunk, timing->max);
+  writeStatsText(chunk, ", total ");
+  writeStatsNumber(chunk, timing->total);
+  writeStatsText(chunk, "\r\n");
+}
+
+void {{rendering.module_prefix}}_writeStats({{rendering.module_prefix}}Context const *ctx, DocoptWriteFunc write) {
+  {{rendering.module_prefix}}Stats const *stats = &ctx->stats;
+  HelpChunk chunk = {write, 0, {0}};
+
+  writeTiming(&chunk, "parse", &stats->parse);
+  writeTiming(&chunk, "dispatch", &stats->dispatch);
+  for ({{commandIndexType}} i = 0; i < {{rendering.commands|length}}; i++) {
+    if (stats->commands[i].calls > 0) {
+      writeTiming(&chunk, CommandNames[i], &stats->commands[i]);
+    }
+  }
+  for (uint8_t i = 0; i < DOCOPT_ERROR_COUNT; i++) {
+    if (stats->errors[i] > 0) {
+      writeStatsText(&chunk, ErrorNames[i]);
+      writeStatsText(&chunk, ": ");
+      writeStatsNumber(&chunk, stats->errors[i]);
+      writeStatsText(&chunk, "\r\n");
+    }
+  }
+  if (chunk.length > 0) {
+    write(chunk.text, chunk.length);
+  }
+}
+#else
+void {{rendering.module_prefix}}_writeStats({{rendering.module_prefix}}Context const *ctx, DocoptWriteFunc write) {
+  (void)ctx;
+  static const char text[] = "No stats (compiled without {{instrument}})\r\n";
+  write(text, sizeof(text) - 1);
+}
+#endif
+{%- if not rendering.typed_args %}
+
+{{rendering.module_prefix}}Context *{{rendering.module_prefix}}_contextOf({{rendering.module_prefix}}Args *args) {
+  // i.e. the args are the first member of the context they are in
+  return ({{rendering.module_prefix}}Context *)args;
 }
+{%- endif %}
+{%- endif %}
@@ -1,32 +1,365 @@
 #pragma once
 
-#include "docopt_args.h"
+{% set module = module if module is defined else none -%}
+{% if module -%}
+#include "{{rendering.include_name}}_autogen.h"
+
+// The handlers of the {{module.name}} commands, which {{rendering.module_prefix}}_processCommand()
+// (and the other calls of {{rendering.include_name}}_autogen.h) match along with those of
+// the other modules, and then call.
+{% set options = rendering.module_options(module) -%}
+{% if options %}
+// Named Options
+//
+// The module's names for the slots of its options in {{rendering.module_prefix}}Args.optionValue.
+
+enum {{module.module_prefix}}Option {
+{%- for option in options %}
+  {{rendering.option_enum(option.name, module)}} = {{rendering.option_enum(option.name)}},
+{%- endfor %}
+};
+{% endif %}
+{% else -%}
+#include "{{rendering.args_header}}"
 
 #include <stdbool.h>
 #include <stdint.h>
 
+{% set context = rendering.module_prefix + "Context" -%}
+{% if rendering.instrument -%}
+{% set instrument = rendering.include_name|upper + "_INSTRUMENT" -%}
+// Compiled with {{instrument}} defined (to 1), the parsing, the dispatch
+// and each handler are timed with {{rendering.module_prefix}}_timestamp(), and the errors
+// counted, in the stats of the context of each call. The "stats" command can
+// then write them out with {{rendering.module_prefix}}_writeStats().
+
+#ifndef {{instrument}}
+#define {{instrument}} 0
+#endif
+
+#if {{instrument}}
+typedef uint32_t {{rendering.module_prefix}}Cycles;
+
+typedef struct {
+  {%- if rendering.resumable %}
+  uint32_t calls; // i.e. a command once, while min and max are of its slices
+  {%- else %}
+  uint32_t calls;
+  {%- endif %}
+  {{rendering.module_prefix}}Cycles min;
+  {{rendering.module_prefix}}Cycles max;
+  uint64_t total;
+} {{rendering.module_prefix}}Timing;
+
+typedef struct {
+  {{rendering.module_prefix}}Timing parse;
+  {{rendering.module_prefix}}Timing dispatch; // i.e. finding and calling the handler
+  {{rendering.module_prefix}}Timing commands[{{rendering.commands|length}}]; // in the order of the usage lines
+  uint32_t errors[DOCOPT_ERROR_COUNT]; // i.e. DOCOPT_NO_ERROR counts the rest
+} {{rendering.module_prefix}}Stats;
+#endif
+
+{% endif -%}
+/**
+ * Everything a call needs while it parses a command, sized to fit this CLI
+ * (e.g. {{rendering.args_header}} has room for the most positional
+ * arguments any usage line takes).
+ * Give each caller (e.g. each shell, on its own task) its own, and the calls
+ * don't share anything.
+ */
+typedef struct {
+  {{rendering.module_prefix}}Args args;
+{%- if rendering.instrument and not rendering.typed_args %} // i.e. first, see {{rendering.module_prefix}}_contextOf(){% endif %}
+  DocoptToken argv[{{rendering.include_name|upper}}_ARGS_TOKENS_MAX];
+{%- if rendering.resumable %}
+  bool pending; // i.e. its command is waiting to be resumed
+{%- endif %}
+{%- if rendering.instrument %}
+#if {{instrument}}
+  {{rendering.module_prefix}}Stats stats; // i.e. of the calls with this context
+{%- if rendering.resumable %}
+  bool resuming; // i.e. the later slices of a command aren't calls of it
+{%- endif %}
+#endif
+{%- endif %}
+} {{context}};
+
+/**
+ * Process the tokens from a single command, given as slices of the line (e.g.
+ * from Docopt_tokenize()), which is not changed.
+ */
+char const *{{rendering.module_prefix}}_processLineCtx({{context}} *ctx, char const *line, DocoptSlice const *slices, uint8_t count);
+
 /**
- * Process the tokens from a single command.
+ * Process the tokens from a single command, already split into strings (which
+ * are not changed, and have no quotes to remove).
+ */
+char const *{{rendering.module_prefix}}_processCommandCtx({{context}} *ctx, uint8_t argc, char **argv);
+
+/**
+ * The same as the calls above, without a context of their own.
  *
 {%- if rendering.multithreaded %}
- * NB: This implementation is threadsafe, but a DocoptArgs struct on the stack.
+ * NB: These are threadsafe, but put a {{context}} on the stack{{" (so their\n *     stats are dropped after each call)" if rendering.instrument}}.
 {%- else %}
- * NB: This implementation is NOT threadsafe, as it shares a static DocoptArgs struct with all callers.
+ * NB: These are NOT threadsafe, as they share a static {{context}} with all callers.
 {%- endif %}
  */
+char const *{{rendering.module_prefix}}_processLine(char const *line, DocoptSlice const *slices, uint8_t count);
 char const *{{rendering.module_prefix}}_processCommand(uint8_t argc, char **argv);
+{% if rendering.resumable -%}
+{% set pending = rendering.include_name|upper + "_PENDING" %}
+// Resumable Commands
+//
+// A handler can do a long job (e.g. erasing flash) a slice at a time, so that
+// the caller can get on with other things (e.g. reading the UART) between the
+// slices. It returns {{pending}} when it has more to do, keeping where it got
+// to in args->resume (which is 0 on its first call), and is called again with
+// the same arguments each time the command is resumed. Cancelling it calls it
+// once more, with args->cancel set, to tidy up.
+//
+// NB: The command is kept in the context, so finish (or cancel) it before
+//     processing another line with the same one.
+{%- if rendering.multithreaded %}
+//     The commands of the calls without a context can't be resumed, as
+//     theirs is on the stack.
+{%- endif %}
+
+extern char const {{rendering.module_prefix}}_pending[];
+#define {{pending}} ({{rendering.module_prefix}}_pending)
+
+/**
+ * Runs the next slice of the context's pending command.
+ *
+ * Returns {{pending}} until the command is done, and then its result (or
+ * NULL if there was no command to resume).
+ */
+char const *{{rendering.module_prefix}}_resumeCtx({{context}} *ctx);
+
+/**
+ * Cancels the context's pending command, and returns its result (NULL if
+ * there was no command to cancel).
+ */
+char const *{{rendering.module_prefix}}_cancelCtx({{context}} *ctx);
+{%- if not rendering.multithreaded %}
+
+/**
+ * The same as the calls above, for the commands of the calls without a
+ * context of their own.
+ */
+char const *{{rendering.module_prefix}}_resume(void);
+char const *{{rendering.module_prefix}}_cancel(void);
+{%- endif %}
+
+{% endif -%}
+{% if rendering.binary -%}
+// Binary Frames
+//
+// A host (e.g. a test rack) can send each command as a frame (see
+// docopt_tokenize.h) rather than a line, which is neither formatted, echoed
+// nor tokenized: the command is found by its ID, and each argument by its kind
+// (and its option's ID). The IDs are worked out from the names (so they only
+// change if a name does), and {{rendering.include_name}}_binary.py encodes the frames.
+
+enum {{rendering.module_prefix}}CommandId {
+{%- for id, command in rendering.binary_commands %}
+  {{rendering.binary_command_enum(command)}} = 0x{{"%04x"|format(id)}}, // {{command.parts|join(" ")}}
+{%- endfor %}
+};
+
+enum {{rendering.module_prefix}}OptionId {
+{%- for id, name, _ in rendering.binary_options %}
+  {{rendering.binary_option_enum(name)}} = 0x{{"%04x"|format(id)}}, // {{name}}
+{%- endfor %}
+};
+
+/**
+ * Process a command given as a binary frame (after its magic byte), e.g. as
+ * it arrives on a UART that the magic byte has switched to binary.
+ *
+ * Returns what the handler does, as for a line (or the error handler, with
+ * DOCOPT_ERROR_BAD_FRAME if the frame is cut short or its CRC is wrong).
+ */
+char const *{{rendering.module_prefix}}_processFrameCtx({{context}} *ctx, uint8_t const *frame, uint8_t length);
+char const *{{rendering.module_prefix}}_processFrame(uint8_t const *frame, uint8_t length);
+
+{% endif -%}
+{% if rendering.streaming -%}
+{% set stream = rendering.module_prefix + "Stream" -%}
+
+// Streaming
+//
+// Tokenizes a line and matches its command words while it is being typed, so
+// that once it is entered only its other arguments are left to collect
+// before the handler is called.
+
+typedef struct {
+  /* the tokens so far, and the command word matched by each */
+  DocoptSlice slices[{{rendering.include_name|upper}}_ARGS_TOKENS_MAX];
+  {{rendering.tokens|length|c_int_type}} matched[{{rendering.include_name|upper}}_ARGS_TOKENS_MAX];
+  uint8_t count;
+  {{rendering.module_prefix}}TokenMask consumed;
+{%- if rendering.opcode_words == 1 %}
+  {{rendering.module_prefix}}Opcode opcode;
+{%- else %}
+  {{rendering.module_prefix}}OpcodeWord opcode[{{rendering.include_name|upper}}_ARGS_OPCODE_WORDS];
+{%- endif %}
+  uint8_t helpCount;
+  bool tooManyTokens;
+  /* how much of the line has been seen, and the token being typed */
+  uint8_t length;
+  bool inToken;
+  uint8_t start;
+  char quote;
+  bool escaped;
+{%- if rendering.matcher == "trie" %}
+  bool matching;
+  {{rendering.token_trie.tokens|length|c_uint_type}} node;
+{%- endif %}
+} {{stream}};
+
+void {{rendering.module_prefix}}_streamReset({{stream}} *stream);
+
+/**
+ * Lets the stream know that the line has changed from changedFrom onwards
+ * (e.g. a character typed or rubbed out, or the whole line replaced from 0),
+ * and is now length long.
+ *
+ * NB: The work for each call is bounded by the characters added, plus going
+ *     back over the last token if it was changed.
+ */
+void {{rendering.module_prefix}}_streamUpdate({{stream}} *stream, char const *line, uint8_t length, uint8_t changedFrom);
+
+/**
+ * Process the line once it is entered, which only has to collect the
+ * arguments that aren't command words before calling the handler. The stream
+ * is then reset for the next line.
+ */
+char const *{{rendering.module_prefix}}_streamEndCtx({{context}} *ctx, {{stream}} *stream, char const *line, uint8_t length);
+char const *{{rendering.module_prefix}}_streamEnd({{stream}} *stream, char const *line, uint8_t length);
+{% endif -%}
 char const *{{rendering.module_prefix}}_getPrompt(void);
+{% if not rendering.compress_help -%}
 char const *{{rendering.module_prefix}}_getHelpText(void);
+{% endif -%}
+/**
+ * Writes the help text a few characters at a time (decompressing it, if it
+ * was generated with --compress-help), e.g. straight to the output.
+ */
+void {{rendering.module_prefix}}_writeHelp(DocoptWriteFunc write);
+{% if rendering.help_usage_line is not none -%}
+/**
+ * Writes only the usage lines of the commands that have the command words of
+ * the arguments (e.g. "mine ?"), and the lines of their options. Without any
+ * command words it writes the whole help text.
+ */
+void {{rendering.module_prefix}}_writeCommandHelp({{rendering.module_prefix}}Args const *args,
+{{" " * (rendering.module_prefix|length + 23)}}DocoptWriteFunc write);
+{% endif -%}
+{% if rendering.completion %}
+/**
+ * Finishes the last word of the line (a command word that goes with the
+ * command words before it, or a "--" option) as far as all of the words that
+ * could finish it agree, with a space (or "=") after it if there is only one.
+ *
+ * Returns the number of characters written to completion (at most size),
+ * which are to be added to the end of the line.
+ */
+uint8_t {{rendering.module_prefix}}_complete(char const *line, uint8_t length,
+{{" " * (rendering.module_prefix|length + 18)}}char *completion, uint8_t size);
+
+/**
+ * Writes each of the words that could finish the last word of the line (e.g.
+ * for a second TAB), each followed by two spaces.
+ */
+void {{rendering.module_prefix}}_listCompletions(char const *line, uint8_t length,
+{{" " * (rendering.module_prefix|length + 22)}}DocoptWriteFunc write);
+{% endif %}
+{% if rendering.options -%}
+// Named Options
+//
+// The slot of each option in {{rendering.module_prefix}}Args.optionValue, which is NULL unless
+// the option was given (and is then its value, if it takes one).
+
+enum {{rendering.module_prefix}}Option {
+  {% for option in rendering.options -%}
+  {{(rendering.option_enum(option.name) + ",").ljust(30)}} // {{"--" + option.name if option.long}}{{", " if option.long and option.short}}{{"-" + option.short if option.short}}
+  {% endfor -%}
+  {{rendering.include_name|upper}}_OPTION_COUNT
+};
+
+{% endif -%}
+{% if rendering.instrument -%}
+{% set instrument = rendering.include_name|upper + "_INSTRUMENT" -%}
+// Instrumentation (see the {{rendering.module_prefix}}Stats of the context)
+
+#if {{instrument}}
+/**
+ * Implement this to give the time now, e.g. from a cycle counter (which may
+ * wrap around).
+ */
+{{rendering.module_prefix}}Cycles {{rendering.module_prefix}}_timestamp(void);
+
+{{rendering.module_prefix}}Stats const *{{rendering.module_prefix}}_getStats({{context}} const *ctx);
+void {{rendering.module_prefix}}_resetStats({{context}} *ctx);
+#endif
+{%- if not rendering.typed_args %}
 
+/**
+ * The context that a handler's arguments are in, e.g. for the "stats" handler
+ * to write out the stats of its own context.
+ */
+{{context}} *{{rendering.module_prefix}}_contextOf({{rendering.module_prefix}}Args *args);
+{%- endif %}
+
+/**
+ * Writes a line for the parsing, the dispatch, each command that has been
+ * called and each error that has happened in the context (or that there are
+ * no stats, when compiled without {{instrument}}).
+ */
+void {{rendering.module_prefix}}_writeStats({{context}} const *ctx, DocoptWriteFunc write);
+
+{% endif -%}
 // Command Handlers
 
-char const *{{rendering.module_prefix}}_handle_Help(DocoptArgs *args);
-char const *{{rendering.module_prefix}}_handle_Error(DocoptArgs *args);
+char const *{{rendering.module_prefix}}_handle_Help({{rendering.module_prefix}}Args *args);
+char const *{{rendering.module_prefix}}_handle_Error({{rendering.module_prefix}}Args *args);
+
+{% endif -%}
+{% if rendering.typed_args -%}
+// Command Arguments
+//
+// NB: These are only filled in (and the handlers called) once the arguments
+//     have been checked against the usage line.
 
+{% for command in rendering.commands_of(module) -%}
+{% set fields = rendering.fields(command) -%}
+{% if fields -%}
+typedef struct {
+  {%- for field in fields %}
+  {{field.ctype}}{{" " if not field.ctype.endswith("*")}}{{field.name}};
+  {%- if field.repeated %}
+  uint8_t {{field.name}}Count;
+  {%- endif %}
+  {%- endfor %}
+} {{rendering.typed_args_name(command)}};
+
+{% endif -%}
+{% endfor -%}
+{% endif -%}
 // AUTOGENERATED START
-{% for command in rendering.commands -%}
+{% for command in rendering.commands_of(module) -%}
+{% set prefix = rendering.handler_prefix(command) -%}
 // > {{command.docopt_text}}
-char const *{{rendering.module_prefix}}_handle_{{command.function_name}}(DocoptArgs *args);
+{% if rendering.typed_args -%}
+{% if rendering.fields(command) -%}
+char const *{{prefix}}_handle_{{command.function_name}}({{rendering.typed_args_name(command)}} const *args);
+{% else -%}
+char const *{{prefix}}_handle_{{command.function_name}}(void);
+{% endif -%}
+{% else -%}
+char const *{{prefix}}_handle_{{command.function_name}}({{rendering.module_prefix}}Args *args);
+{% endif -%}
 {% endfor -%}
 // AUTOGENERATED End
 
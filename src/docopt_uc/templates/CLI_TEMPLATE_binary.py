@@ -0,0 +1,110 @@
+"""Binary frames of the {{rendering.module_name}} commands
+
+Encodes the commands as the frames that {{rendering.module_prefix}}_processFrame() takes (see
+docopt_tokenize.h), e.g. for a host that sends many of them, and decodes the
+replies to them. Generated by docopt-uc, along with {{rendering.include_name}}_autogen.c.
+
+    import {{rendering.include_name}}_binary
+{%- set command = rendering.commands[0] %}
+    port.write({{rendering.include_name}}_binary.encode("{{command.parts|join(" ")}}"))
+    error, rest = {{rendering.include_name}}_binary.decode_reply(port.read(...))
+"""
+
+import struct
+
+MAGIC = 0x10
+FRAME_MAX = 255
+POSITIONAL = 0x00
+OPTION = 0x01
+INT = 0x80
+DONE = 0x00
+FAILED = 0x01
+
+# The ID of each command, by its command words
+COMMANDS = {
+{%- for id, command in rendering.binary_commands %}
+    "{{command.parts|join(" ")}}": 0x{{"%04x"|format(id)}},
+{%- endfor %}
+}
+
+# The ID of each option, by its name (e.g. "--speed")
+OPTIONS = {
+{%- for id, name, _ in rendering.binary_options %}
+    "{{name}}": 0x{{"%04x"|format(id)}},
+{%- endfor %}
+}
+
+
+def crc16(data, crc=0xFFFF):
+    """The CRC-16 (CCITT) of the bytes, as Docopt_crc16() works it out"""
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+        crc &= 0xFFFF
+    return crc
+
+
+def _argument(kind, value):
+    """An argument of a frame: an int is an int32, anything else is text"""
+    if isinstance(value, bool):
+        raise TypeError("only a flag can be True (or False)")
+    if isinstance(value, int):
+        kind |= INT
+        data = struct.pack("<i", value)
+    elif isinstance(value, str):
+        data = value.encode()
+    else:
+        data = bytes(value)
+    if len(data) > 0xFF:
+        raise ValueError("the value is too long: {!r}".format(value))
+    return bytes([kind, len(data)]) + data
+
+
+def encode(command, *positional, **options):
+    """
+    The frame (starting with the magic byte) of the command, given by its command
+    words (e.g. "{{command.parts|join(" ")}}"), with its positional arguments and its options,
+    e.g. speed=10 for "--speed=10" or moored=True for the flag "--moored" (an
+    option's name can be given as it is, e.g. {"--speed": 10}, too).
+    """
+    body = struct.pack("<H", COMMANDS[command])
+    for value in positional:
+        body += _argument(POSITIONAL, value)
+    for name, value in options.items():
+        if value is None or value is False:
+            continue
+        if not name.startswith("-"):
+            name = "--" + name
+            if name not in OPTIONS:
+                name = name.replace("_", "-")
+        # i.e. the option's ID goes between its kind and its value
+        argument = _argument(OPTION, "" if value is True else value)
+        body += argument[:1] + struct.pack("<H", OPTIONS[name]) + argument[1:]
+    if len(body) + 3 > FRAME_MAX:
+        raise ValueError("the frame is too long ({} bytes)".format(
+            len(body) + 3))
+    frame = bytes([len(body)]) + body
+    return bytes([MAGIC]) + frame + struct.pack("<H", crc16(frame))
+
+
+def decode_reply(data):
+    """
+    The first reply in data (after anything before it, e.g. the text that the
+    handler wrote) as (error, rest), where error is None if the command was
+    done and its error if it failed, and rest is what comes after the reply.
+    Returns None if there isn't a whole reply in data yet.
+    """
+    start = data.find(bytes([MAGIC]))
+    if start < 0 or len(data) < start + 2:
+        return None
+    length = data[start + 1]
+    end = start + 2 + length + 2
+    if len(data) < end:
+        return None
+    frame = data[start + 1:end - 2]
+    if length < 1 or struct.unpack("<H", data[end - 2:end])[0] != crc16(frame):
+        raise ValueError("the reply's CRC is wrong")
+    if frame[1] == DONE:
+        return None, data[end:]
+    return frame[2:].decode(errors="replace"), data[end:]
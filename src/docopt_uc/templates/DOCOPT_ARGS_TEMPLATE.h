@@ -0,0 +1,75 @@
+{% set ARGS = rendering.include_name|upper + "_ARGS" -%}
+#ifndef {{ARGS}}_H
+#define {{ARGS}}_H
+
+#include "docopt_tokenize.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* The arguments of a command, sized to fit the usage lines of this module */
+
+enum {
+   /* The most tokens a line can have (i.e. the longest usage line, with all
+    * of its options and their values) */
+   {{ARGS}}_TOKENS_MAX = {{rendering.tokens_max}},
+   /* The most arguments of each kind that any usage line takes */
+   {{ARGS}}_NAMED_ARGS_MAX = {{rendering.named_max}},
+   {{ARGS}}_POSITIONAL_ARGS_MAX = {{rendering.positional_max}},
+   /* One slot per option in the "Options:" section (and usage lines) */
+   {{ARGS}}_OPTIONS_MAX = {{[rendering.options|length, 1]|max}},
+   /* Room for the values of the arguments (each NUL terminated) */
+   {{ARGS}}_TEXT_MAX = {{rendering.text_max}},
+};
+
+/* A bitmap with a bit for each token of a line */
+typedef {{rendering.token_mask_type}} {{rendering.module_prefix}}TokenMask;
+
+/* The opcode is a bitmap with one bit per command word ({{rendering.tokens|length}} words) */
+{% if rendering.opcode_words == 1 -%}
+typedef {{rendering.opcode_type}} {{rendering.module_prefix}}Opcode;
+{%- else -%}
+enum {
+   {{ARGS}}_OPCODE_WORDS = {{rendering.opcode_words}},
+   {{ARGS}}_OPCODE_WORD_BITS = 32,
+};
+
+typedef {{rendering.opcode_type}} {{rendering.module_prefix}}OpcodeWord;
+{%- endif %}
+
+typedef struct {
+   /* commands */
+{%- if rendering.opcode_words == 1 %}
+   {{rendering.module_prefix}}Opcode opcode;
+{%- else %}
+   {{rendering.module_prefix}}OpcodeWord opcode[{{ARGS}}_OPCODE_WORDS];
+{%- endif %}
+   /* options without arguments */
+   bool help;
+   /* Why the arguments were rejected (if they were) */
+   enum DocoptError error;
+   /* Known options, by their slot (e.g. NAVALFATE_OPTION_SPEED) */
+   char   *optionValue[{{ARGS}}_OPTIONS_MAX];
+{%- if rendering.named_max %}
+   /* Named Arguments that aren't known options */
+   uint8_t namedCount;
+   char   *namedLabel[{{ARGS}}_NAMED_ARGS_MAX];
+   char   *namedValue[{{ARGS}}_NAMED_ARGS_MAX];
+{%- endif %}
+   /* Positional Arguments */
+   uint8_t posCount;
+{%- if rendering.positional_max %}
+   char   *posValue[{{ARGS}}_POSITIONAL_ARGS_MAX];
+{%- endif %}
+   /* Where the values above live (unquoted), so the line isn't changed */
+   uint8_t textUsed;
+   char    text[{{ARGS}}_TEXT_MAX];
+{%- if rendering.resumable %}
+   /* Where a resumable command got to (0 on its first call), and if this is
+    * its last call because it was cancelled */
+   uint32_t resume;
+   bool     cancel;
+{%- endif %}
+} {{rendering.module_prefix}}Args;
+
+#endif // {{ARGS}}_H